@@ -2,13 +2,16 @@
 //open ioimports
 //taking in a single command line arg hexidecimal address
 //display all hexidecimall adresses and their peripherals
+//or, with -b [file], resolve one address per line of file (or stdin)
+//against /proc/iomem, printing the results in input order and the
+//addresses resolved per second to stderr
 
 
 //#define iomemAdd '/proc/iomem'
 //#define ioportsAdd '/proc/ioports'
 
 #define HEX argv[1]
-#define _POSIX_SOURCE
+#define _POSIX_C_SOURCE 200809L
 
 #include <features.h>
 #include <stdio.h>
@@ -19,28 +22,92 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 
 
+//one line of /proc/iomem or /proc/ioports
+struct range {
+  unsigned long long end;
+  int parent;   //index of the enclosing range, -1 at the top level
+  char * name;
+};
+
+//one address of a batch, remembering where it came from
+struct query {
+  unsigned long long addr;
+  size_t pos;   //line of the input it was read from, from 0
+};
+
+//every range of one file, in the order the file lists them
+//starts are kept in their own array so a lookup's binary search
+//only touches the starts
+struct index {
+  size_t n;
+  size_t cap;
+  unsigned long long * start;
+  struct range * r;
+};
 
 bool isHex(char num);
 bool isValid(const char * hex, int len);
+int loadIndex(FILE * file, struct index * idx);
+int findRange(const struct index * idx, unsigned long long addr);
+void printChain(const struct index * idx, int i);
+void freeIndex(struct index * idx);
+int batch(const char * path);
+int cmpQuery(const void * a, const void * b);
+void sweep(const struct index * idx, const struct query * q, size_t m,
+           int * found);
 
 int main(int argc, char * argv[]) {
+  if(argc >= 2 && strcmp(argv[1], "-b") == 0) {
+    if(argc > 3) {
+      printf("Too many arguments given.\n");
+      return 1;
+    }
+    return batch(argc == 3 ? argv[2] : NULL);
+  }
+
   //ensures that there is only one address given
   if(argc == 2) {
     FILE *mem;
     FILE *ports;
+    struct index memIdx = {0};
+    struct index portIdx = {0};
+    unsigned long long addr;
+
+    if(!isValid(HEX, strlen(HEX))) {
+      printf("%s is not a hexadecimal address\n", HEX);
+      return 1;
+    }
+    addr = strtoull(HEX, NULL, 16);
 
     int m = open("/proc/iomem", O_RDONLY);
     int p = open("/proc/ioports", O_RDONLY);
 
     mem = fdopen(m, "r");
-    ports = fdopen(m, "r");
+    ports = fdopen(p, "r");
+    if(mem == NULL || ports == NULL) {
+      perror("/proc");
+      return 1;
+    }
+    if(loadIndex(mem, &memIdx) != 0 || loadIndex(ports, &portIdx) != 0) {
+      perror("loading resources");
+      return 1;
+    }
+    fclose(mem);
+    fclose(ports);
+
+    printf("iomem:   ");
+    printChain(&memIdx, findRange(&memIdx, addr));
+    printf("ioports: ");
+    printChain(&portIdx, findRange(&portIdx, addr));
 
-    
+    freeIndex(&memIdx);
+    freeIndex(&portIdx);
   }
-  
+
   else if(argc==1)
     printf("Not enough arguments given\n");
   else
@@ -80,3 +147,222 @@ bool isValid(const char * hex, int len) {
   }
   return true;
 }
+
+//reads every "start-end : name" line of file into idx
+//each level of nesting is indented by two more spaces; a stack of the
+//last range seen at each depth gives every range its parent
+//the kernel lists each level sorted by start, and children right after
+//their parent, so the starts come out sorted and need no sort
+//returns 0, or -1 on a malformed line or when out of memory
+int loadIndex(FILE * file, struct index * idx) {
+  char * line = NULL;
+  size_t size = 0;
+  int stack[64];
+  int depth;
+  int top = -1;   //deepest level seen on the previous line
+  int name;
+  unsigned long long start;
+  unsigned long long end;
+
+  while(getline(&line, &size, file) != -1) {
+    depth = 0;
+    while(line[depth] == ' ') depth++;
+    depth /= 2;
+    if(depth >= 64 || depth > top + 1) {
+      free(line);
+      return -1;
+    }
+    if(sscanf(line, " %llx-%llx : %n", &start, &end, &name) != 2) {
+      free(line);
+      return -1;
+    }
+    line[strcspn(line, "\n")] = '\0';
+
+    if(idx->n == idx->cap) {
+      size_t cap = idx->cap ? 2 * idx->cap : 256;
+      unsigned long long * s = realloc(idx->start, cap * sizeof(*s));
+      if(s != NULL) idx->start = s;
+      struct range * r = realloc(idx->r, cap * sizeof(*r));
+      if(r != NULL) idx->r = r;
+      if(s == NULL || r == NULL) {
+        free(line);
+        return -1;
+      }
+      idx->cap = cap;
+    }
+    idx->start[idx->n] = start;
+    idx->r[idx->n].end = end;
+    idx->r[idx->n].parent = depth > 0 ? stack[depth - 1] : -1;
+    idx->r[idx->n].name = strdup(line + name);
+    if(idx->r[idx->n].name == NULL) {
+      free(line);
+      return -1;
+    }
+    stack[depth] = idx->n;
+    top = depth;
+    idx->n++;
+  }
+  free(line);
+  return 0;
+}
+
+//finds the innermost range containing addr, or -1 if none does
+//binary searches for the last range starting at or before addr; the
+//innermost range containing addr is that range or one of its parents,
+//since ranges only overlap when one encloses the other
+int findRange(const struct index * idx, unsigned long long addr) {
+  size_t lo = 0;
+  size_t hi = idx->n;
+  int i;
+
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(idx->start[mid] <= addr) lo = mid + 1;
+    else hi = mid;
+  }
+  i = (int)lo - 1;
+  while(i >= 0 && idx->r[i].end < addr) i = idx->r[i].parent;
+  return i;
+}
+
+//prints every range containing range i, outermost first, then its bounds
+void printChain(const struct index * idx, int i) {
+  int chain[64];
+  int n = 0;
+
+  if(i < 0) {
+    printf("not found\n");
+    return;
+  }
+  for(int j = i; j >= 0 && n < 64; j = idx->r[j].parent) chain[n++] = j;
+  while(n-- > 0) printf("%s%s", idx->r[chain[n]].name, n > 0 ? " > " : "");
+  printf(" [%llx-%llx]\n", idx->start[i], idx->r[i].end);
+}
+
+void freeIndex(struct index * idx) {
+  for(size_t i = 0; i < idx->n; i++) free(idx->r[i].name);
+  free(idx->start);
+  free(idx->r);
+}
+
+//orders queries by address
+int cmpQuery(const void * a, const void * b) {
+  const struct query * x = a;
+  const struct query * y = b;
+
+  if(x->addr != y->addr) return x->addr < y->addr ? -1 : 1;
+  return 0;
+}
+
+//resolves the m queries, sorted by address, in one pass over the ranges
+//the stack holds the chain of ranges that are open at the current
+//address, innermost on top; each range is pushed and popped once, so
+//the pass takes O(n + m)
+//found[q[k].pos] gets the innermost range containing q[k].addr, or -1
+void sweep(const struct index * idx, const struct query * q, size_t m,
+           int * found) {
+  int stack[64];
+  int top = -1;
+  size_t j = 0;
+
+  for(size_t k = 0; k < m; k++) {
+    while(j < idx->n && idx->start[j] <= q[k].addr) {
+      //whatever ends before range j starts cannot enclose it
+      while(top >= 0 && idx->r[stack[top]].end < idx->start[j]) top--;
+      if(top < 63) stack[++top] = j;
+      j++;
+    }
+    while(top >= 0 && idx->r[stack[top]].end < q[k].addr) top--;
+    found[q[k].pos] = top >= 0 ? stack[top] : -1;
+  }
+}
+
+//resolves every address read from path, or stdin if path is NULL or "-"
+//lines that are not hexadecimal addresses are reported as invalid
+int batch(const char * path) {
+  FILE * in = stdin;
+  FILE * mem;
+  struct index memIdx = {0};
+  struct query * q = NULL;
+  unsigned long long * addrs = NULL;
+  bool * valid = NULL;
+  int * found;
+  char * line = NULL;
+  size_t size = 0;
+  size_t lines = 0;
+  size_t cap = 0;
+  size_t m = 0;
+  ssize_t len;
+  struct timespec t0;
+  struct timespec t1;
+  double secs;
+
+  if(path != NULL && strcmp(path, "-") != 0) {
+    in = fopen(path, "r");
+    if(in == NULL) {
+      perror(path);
+      return 1;
+    }
+  }
+  mem = fopen("/proc/iomem", "r");
+  if(mem == NULL || loadIndex(mem, &memIdx) != 0) {
+    perror("/proc/iomem");
+    return 1;
+  }
+  fclose(mem);
+
+  while((len = getline(&line, &size, in)) != -1) {
+    line[strcspn(line, " \t\r\n")] = '\0';
+    if(lines == cap) {
+      cap = cap ? 2 * cap : 4096;
+      q = realloc(q, cap * sizeof(*q));
+      addrs = realloc(addrs, cap * sizeof(*addrs));
+      valid = realloc(valid, cap * sizeof(*valid));
+      if(q == NULL || addrs == NULL || valid == NULL) {
+        perror("batch");
+        return 1;
+      }
+    }
+    valid[lines] = line[0] != '\0' && isValid(line, strlen(line));
+    addrs[lines] = valid[lines] ? strtoull(line, NULL, 16) : 0;
+    if(valid[lines]) {
+      q[m].addr = addrs[lines];
+      q[m].pos = lines;
+      m++;
+    }
+    lines++;
+  }
+  free(line);
+  if(in != stdin) fclose(in);
+
+  found = malloc((lines ? lines : 1) * sizeof(*found));
+  if(found == NULL) {
+    perror("batch");
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  qsort(q, m, sizeof(*q), cmpQuery);
+  sweep(&memIdx, q, m, found);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+  for(size_t i = 0; i < lines; i++) {
+    if(!valid[i]) {
+      printf("line %zu: invalid address\n", i + 1);
+      continue;
+    }
+    printf("%llx: ", addrs[i]);
+    printChain(&memIdx, found[i]);
+  }
+  fflush(stdout);
+  fprintf(stderr, "resolved %zu addresses against %zu ranges in %.3f s "
+          "(%.0f addresses/s)\n", m, memIdx.n, secs,
+          secs > 0 ? m / secs : 0.0);
+
+  free(found);
+  free(valid);
+  free(addrs);
+  free(q);
+  freeIndex(&memIdx);
+  return 0;
+}
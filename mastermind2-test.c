@@ -4,12 +4,19 @@
  */
 
 #include "cs421net.h"
+#include "mastermind2.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/user.h>
 #include <stdlib.h>
@@ -78,6 +85,12 @@ int mmap_test()
 
 	printf("%s\n", c);
 
+	/*guesses made while mapped show up without mapping again */
+	if (write(mm_fd, "1111", 4) == -1)
+		return -1;
+	printf("%s\n", c);
+	munmap(c, PAGE_SIZE);
+
 	if (quit_mastermind() != 0) {
 		printf("\nFailed to end mastermind\n");
 		return -1;
@@ -162,6 +175,289 @@ int overflow_control()
 	return 0;
 }
 
+/** private_session_test()
+    opens /dev/mm twice and gives each file its own game,
+    a guess on one must not show up in the other
+    returns 0 on success -1 on failure
+ */
+int private_session_test()
+{
+	int fd1;
+	int fd2;
+	char buf1[5] = { 0 };
+	char buf2[5] = { 0 };
+
+	fd1 = open("/dev/mm", O_RDWR);
+	fd2 = open("/dev/mm", O_RDWR);
+	if (fd1 == -1 || fd2 == -1) {
+		printf("Could not open /dev/mm\n");
+		return -1;
+	}
+	if (ioctl(fd1, MM_IOC_PRIVATE) == -1
+	    || ioctl(fd2, MM_IOC_PRIVATE) == -1) {
+		printf("MM_IOC_PRIVATE failed\n");
+		return -1;
+	}
+
+	if (write(fd1, "4211", 4) == -1)
+		return -1;
+	if (read(fd1, buf1, 4) == -1 || read(fd2, buf2, 4) == -1)
+		return -1;
+	close(fd1);
+	close(fd2);
+
+	printf("private game 1: %s, private game 2: %s\n", buf1, buf2);
+	if (buf2[1] != '-') {
+		printf("private games are not independent\n");
+		return -1;
+	}
+	return 0;
+}
+
+/** batch_test()
+    scores several guesses with one write and reads
+    every score back with one read
+    returns 0 on success -1 on failure
+ */
+int batch_test()
+{
+	int fd;
+	char buf[MM_MAX_BATCH * 4 + 1] = { 0 };
+	ssize_t n;
+
+	fd = open("/dev/mm", O_RDWR);
+	if (fd == -1 || ioctl(fd, MM_IOC_PRIVATE) == -1)
+		return -1;
+
+	n = write(fd, "1234\n1111\n4x11\n", 15);
+	if (n != 10) {
+		printf("batch should stop at the bad guess, wrote %zd\n", n);
+		close(fd);
+		return -1;
+	}
+	if (read(fd, buf, sizeof(buf) - 1) != 8) {
+		close(fd);
+		return -1;
+	}
+	printf("batch results: %s\n", buf);
+	close(fd);
+	return 0;
+}
+
+/** ioctl_test()
+    plays a private game through the binary ioctl interface
+    returns 0 on success -1 on failure
+ */
+int ioctl_test()
+{
+	int fd;
+	__u32 version;
+	struct mm_ioc_start start = { 0 };
+	struct mm_ioc_guess guess = { {4, 2, 1, 1} };
+	struct mm_ioc_state state;
+
+	fd = open("/dev/mm", O_RDWR);
+	if (fd == -1 || ioctl(fd, MM_IOC_PRIVATE) == -1)
+		return -1;
+	if (ioctl(fd, MM_IOC_VERSION, &version) == -1
+	    || version != MM_ABI_VERSION) {
+		printf("unexpected ABI version\n");
+		close(fd);
+		return -1;
+	}
+	if (ioctl(fd, MM_IOC_START, &start) == -1
+	    || ioctl(fd, MM_IOC_GUESS, &guess) == -1
+	    || ioctl(fd, MM_IOC_GET_STATE, &state) == -1) {
+		printf("ioctl interface failed\n");
+		close(fd);
+		return -1;
+	}
+	printf("ioctl guess: B%uW%u after %u guesses, active %u\n",
+	       guess.black, guess.white, state.num_guesses, state.active);
+	ioctl(fd, MM_IOC_QUIT);
+	close(fd);
+	return 0;
+}
+
+/** shape_test()
+    starts a private game of 10 pegs and 16 colors and
+    checks that hexadecimal guesses of that length are scored
+    returns 0 on success -1 on failure
+ */
+int shape_test()
+{
+	int fd;
+	struct mm_ioc_start start = { 10, 16 };
+	struct mm_ioc_state state;
+	char buf[8];
+	int ret = 0;
+
+	fd = open("/dev/mm", O_RDWR);
+	if (fd == -1 || ioctl(fd, MM_IOC_PRIVATE) == -1
+	    || ioctl(fd, MM_IOC_START, &start) == -1)
+		return -1;
+	/*a guess of the default length is too short now */
+	if (write(fd, "1234", 4) != -1)
+		ret = -1;
+	if (write(fd, "0123456789 abcdefabcd", 21) != 21
+	    || read(fd, buf, sizeof(buf)) != 8
+	    || ioctl(fd, MM_IOC_GET_STATE, &state) == -1
+	    || state.pegs != 10 || state.colors != 16
+	    || state.num_guesses != 2)
+		ret = -1;
+	else
+		printf("shape test: %.8s\n", buf);
+
+	close(fd);
+	return ret;
+}
+
+/** few_colors_test()
+    starts a private game of 4 pegs and 4 colors, where the old
+    fixed code 4211 is not a valid code, and checks that it can
+    still be won by trying every code
+    returns 0 on success -1 on failure
+ */
+int few_colors_test()
+{
+	int fd;
+	struct mm_ioc_start start = { 4, 4 };
+	struct mm_ioc_guess guess;
+	unsigned code;
+	int k;
+	int ret = -1;
+
+	fd = open("/dev/mm", O_RDWR);
+	if (fd == -1 || ioctl(fd, MM_IOC_PRIVATE) == -1
+	    || ioctl(fd, MM_IOC_START, &start) == -1)
+		return -1;
+	for (code = 0; code < 4 * 4 * 4 * 4; code++) {
+		memset(&guess, 0, sizeof(guess));
+		for (k = 0; k < 4; k++)
+			guess.pegs[k] = (code >> (2 * (3 - k))) & 3;
+		if (ioctl(fd, MM_IOC_GUESS, &guess) == -1)
+			break;
+		if (guess.black == 4) {
+			printf("4x4 game won after %u guesses\n",
+			       guess.num_guesses);
+			ret = 0;
+			break;
+		}
+	}
+	if (ret)
+		printf("4x4 game could not be won\n");
+	close(fd);
+	return ret;
+}
+
+/** poll_test()
+    checks that a scored guess makes /dev/mm readable
+    and that reading the result clears it again
+    returns 0 on success -1 on failure
+ */
+int poll_test()
+{
+	struct pollfd pfd;
+	char buf[4];
+	int ret = 0;
+
+	pfd.fd = open("/dev/mm", O_RDWR);
+	if (pfd.fd == -1 || ioctl(pfd.fd, MM_IOC_PRIVATE) == -1)
+		return -1;
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, 0) != 0) {
+		printf("fresh game should not be readable\n");
+		ret = -1;
+	}
+	if (write(pfd.fd, "1234", 4) == -1
+	    || poll(&pfd, 1, 1000) != 1 || !(pfd.revents & POLLIN)) {
+		printf("scored guess did not wake poll\n");
+		ret = -1;
+	}
+	if (read(pfd.fd, buf, 4) == -1 || poll(&pfd, 1, 0) != 0) {
+		printf("read did not clear POLLIN\n");
+		ret = -1;
+	}
+	close(pfd.fd);
+	return ret;
+}
+
+/** ring_test()
+    maps the history ring of a private game and
+    prints the lines streamed into it
+    returns 0 on success -1 on failure
+ */
+int ring_test()
+{
+	int fd;
+	long page = sysconf(_SC_PAGESIZE);
+	size_t len = (1 + MM_RING_PAGES) * page;
+	struct mm_ring_header *ring;
+	const char *data;
+	__u32 head;
+	__u32 i;
+
+	fd = open("/dev/mm", O_RDWR);
+	if (fd == -1 || ioctl(fd, MM_IOC_PRIVATE) == -1)
+		return -1;
+	ring = mmap(NULL, len, PROT_READ, MAP_SHARED, fd,
+		    MM_MMAP_RING_PGOFF * page);
+	if (ring == MAP_FAILED) {
+		printf("Could not map the history ring\n");
+		close(fd);
+		return -1;
+	}
+	data = (const char *)ring + ring->data_offset;
+
+	if (write(fd, "1234 1111 4211", 14) == -1)
+		return -1;
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	for (i = ring->tail; i != head; i++)
+		putchar(data[i % ring->size]);
+
+	munmap(ring, len);
+	close(fd);
+	return 0;
+}
+
+/** shared_state_test()
+    maps the state page of a private game and checks
+    that a guess shows up in it without a read()
+    returns 0 on success -1 on failure
+ */
+int shared_state_test()
+{
+	int fd;
+	long page = sysconf(_SC_PAGESIZE);
+	const struct mm_shared_state *shared;
+	struct mm_shared_state snap;
+	int ret = 0;
+
+	fd = open("/dev/mm", O_RDWR);
+	if (fd == -1 || ioctl(fd, MM_IOC_PRIVATE) == -1)
+		return -1;
+	shared = mmap(NULL, page, PROT_READ, MAP_SHARED, fd,
+		      MM_MMAP_STATE_PGOFF * page);
+	if (shared == MAP_FAILED) {
+		printf("Could not map the shared state\n");
+		close(fd);
+		return -1;
+	}
+
+	if (write(fd, "1234", 4) == -1)
+		ret = -1;
+	mm_shared_state_read(shared, &snap);
+	printf("shared state: %u guesses, result %.4s, active %u\n",
+	       snap.num_guesses, snap.last_result, snap.game_active);
+	if (snap.num_guesses != 1)
+		ret = -1;
+
+	munmap((void *)shared, page);
+	close(fd);
+	return ret;
+}
+
 int game_inactive_read()
 {
 	char buf[10];
@@ -181,8 +477,340 @@ int game_inactive_write()
 		return -1;
 }
 
-int main(void)
+/*
+ * Load generator: "mastermind2-test load [options]" runs players against
+ * /dev/mm from many threads for a while, then prints the throughput and
+ * latency percentiles of each kind of call.
+ */
+
+enum load_op { LOAD_START, LOAD_GUESS, LOAD_READ, LOAD_MMAP, LOAD_NR_OPS };
+
+static const char *const load_op_names[LOAD_NR_OPS] = {
+	"start", "guess", "read", "mmap"
+};
+
+/*
+ * latencies are kept in a log-linear histogram: LOAD_SUB_BUCKETS
+ * buckets per power of two nanoseconds, so a percentile is off by at
+ * most 1 / LOAD_SUB_BUCKETS
+ */
+#define LOAD_SUB_BITS 4
+#define LOAD_SUB_BUCKETS (1 << LOAD_SUB_BITS)
+#define LOAD_BUCKETS (64 * LOAD_SUB_BUCKETS)
+
+struct load_hist {
+	unsigned long long count;
+	unsigned long long errors;
+	unsigned long long buckets[LOAD_BUCKETS];
+};
+
+struct load_config {
+	unsigned threads;
+	unsigned players;
+	unsigned uids;
+	unsigned base_uid;
+	unsigned seconds;
+	int private_games;
+	/* relative weights of each op, and their sum */
+	unsigned mix[LOAD_NR_OPS];
+	unsigned mix_total;
+};
+
+struct load_thread {
+	const struct load_config *cfg;
+	pthread_barrier_t *barrier;
+	unsigned id;
+	/* players of this thread, one open /dev/mm each */
+	int *fds;
+	unsigned nfds;
+	struct load_hist hist[LOAD_NR_OPS];
+};
+
+static int load_stop;
+
+static unsigned long long load_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned load_bucket(unsigned long long ns)
+{
+	unsigned msb;
+
+	if (ns < LOAD_SUB_BUCKETS)
+		return ns;
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - LOAD_SUB_BITS + 1) * LOAD_SUB_BUCKETS +
+	    ((ns >> (msb - LOAD_SUB_BITS)) & (LOAD_SUB_BUCKETS - 1));
+}
+
+/* largest latency that falls into bucket b */
+static unsigned long long load_bucket_max(unsigned b)
+{
+	unsigned shift;
+
+	if (b < LOAD_SUB_BUCKETS)
+		return b;
+	shift = b / LOAD_SUB_BUCKETS - 1;
+	return ((unsigned long long)(LOAD_SUB_BUCKETS + b % LOAD_SUB_BUCKETS + 1)
+		<< shift) - 1;
+}
+
+static unsigned long long load_percentile(const struct load_hist *h,
+					  double pct)
+{
+	unsigned long long want = h->count * pct / 100;
+	unsigned long long seen = 0;
+	unsigned b;
+
+	for (b = 0; b < LOAD_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if (seen > want)
+			return load_bucket_max(b);
+	}
+	return 0;
+}
+
+/* run one op of a player, returning 0 on success -1 on failure */
+static int load_op(int fd, enum load_op op, unsigned *seed)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	struct mm_ioc_start start = { 0 };
+	char buf[4];
+	void *view;
+	unsigned i;
+
+	switch (op) {
+	case LOAD_START:
+		return ioctl(fd, MM_IOC_START, &start);
+	case LOAD_GUESS:
+		for (i = 0; i < 4; i++)
+			buf[i] = '0' + rand_r(seed) % 6;
+		return write(fd, buf, 4) == 4 ? 0 : -1;
+	case LOAD_READ:
+		return read(fd, buf, 4) == -1 ? -1 : 0;
+	case LOAD_MMAP:
+		view = mmap(NULL, page, PROT_READ, MAP_SHARED, fd,
+			    MM_MMAP_VIEW_PGOFF * page);
+		if (view == MAP_FAILED)
+			return -1;
+		/*touch it, so the page is actually faulted in */
+		*(volatile char *)view;
+		return munmap(view, page);
+	default:
+		return -1;
+	}
+}
+
+static void *load_thread_fn(void *arg)
 {
+	struct load_thread *t = arg;
+	const struct load_config *cfg = t->cfg;
+	struct mm_ioc_start start = { 0 };
+	unsigned seed = t->id * 2654435761U + 1;
+	unsigned long long t0;
+	unsigned long long ns;
+	enum load_op op;
+	unsigned pick;
+	unsigned i;
+	int ret;
+
+	/*
+	 * the driver keys shared games by the real uid of the caller; the
+	 * raw syscall changes it for this thread only, where glibc's
+	 * setresuid() would change it for the whole process
+	 */
+	if (cfg->uids > 1 && !cfg->private_games) {
+		uid_t uid = cfg->base_uid + t->id % cfg->uids;
+
+		if (syscall(SYS_setresuid, uid, uid, -1) != 0 && t->id == 0)
+			printf("load: cannot switch uids (%s), using one uid\n",
+			       strerror(errno));
+	}
+
+	for (i = 0; i < t->nfds; i++) {
+		t->fds[i] = open("/dev/mm", O_RDWR);
+		if (t->fds[i] == -1 ||
+		    (cfg->private_games && ioctl(t->fds[i], MM_IOC_PRIVATE) == -1)
+		    || ioctl(t->fds[i], MM_IOC_START, &start) == -1) {
+			printf("load: could not set up player: %s\n",
+			       strerror(errno));
+			t->nfds = i + (t->fds[i] != -1);
+			break;
+		}
+	}
+
+	pthread_barrier_wait(t->barrier);
+	for (i = 0; t->nfds > 0 && !__atomic_load_n(&load_stop, __ATOMIC_RELAXED);
+	     i = (i + 1) % t->nfds) {
+		pick = rand_r(&seed) % cfg->mix_total;
+		for (op = 0; pick >= cfg->mix[op]; op++)
+			pick -= cfg->mix[op];
+
+		t0 = load_now_ns();
+		ret = load_op(t->fds[i], op, &seed);
+		ns = load_now_ns() - t0;
+
+		t->hist[op].count++;
+		t->hist[op].buckets[load_bucket(ns)]++;
+		if (ret == -1) {
+			t->hist[op].errors++;
+			/*a won game refuses guesses until it is started again */
+			if (op == LOAD_GUESS && errno == EINVAL)
+				ioctl(t->fds[i], MM_IOC_START, &start);
+		}
+	}
+
+	for (i = 0; i < t->nfds; i++)
+		close(t->fds[i]);
+	return NULL;
+}
+
+static void load_usage(void)
+{
+	printf("usage: mastermind2-test load [-t threads] [-n players] "
+	       "[-u uids] [-b base_uid] [-d seconds] "
+	       "[-m start:guess:read:mmap] [-P]\n"
+	       "  -u spreads threads over uids (needs root), "
+	       "-P gives every player a private game\n");
+	exit(2);
+}
+
+/** load_test()
+    runs the load generator with the options after "load"
+    and prints per-op throughput and latency percentiles
+    returns 0 on success -1 on failure
+ */
+int load_test(int argc, char *argv[])
+{
+	struct load_config cfg = {
+		.players = 0,
+		.uids = 1,
+		.base_uid = 10000,
+		.seconds = 5,
+		.mix = { 1, 8, 8, 1 },
+	};
+	struct load_thread *threads;
+	struct load_hist total;
+	pthread_barrier_t barrier;
+	pthread_t *tids;
+	unsigned long long t0;
+	double elapsed;
+	unsigned long long all = 0;
+	unsigned i;
+	unsigned b;
+	int op;
+	int opt;
+
+	cfg.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "t:n:u:b:d:m:P")) != -1) {
+		switch (opt) {
+		case 't':
+			cfg.threads = atoi(optarg);
+			break;
+		case 'n':
+			cfg.players = atoi(optarg);
+			break;
+		case 'u':
+			cfg.uids = atoi(optarg);
+			break;
+		case 'b':
+			cfg.base_uid = atoi(optarg);
+			break;
+		case 'd':
+			cfg.seconds = atoi(optarg);
+			break;
+		case 'm':
+			if (sscanf(optarg, "%u:%u:%u:%u", &cfg.mix[LOAD_START],
+				   &cfg.mix[LOAD_GUESS], &cfg.mix[LOAD_READ],
+				   &cfg.mix[LOAD_MMAP]) != 4)
+				load_usage();
+			break;
+		case 'P':
+			cfg.private_games = 1;
+			break;
+		default:
+			load_usage();
+		}
+	}
+	if (cfg.threads < 1)
+		cfg.threads = 1;
+	if (cfg.players < cfg.threads)
+		cfg.players = cfg.players ? cfg.threads : 4 * cfg.threads;
+	if (cfg.uids < 1)
+		cfg.uids = 1;
+	for (op = 0; op < LOAD_NR_OPS; op++)
+		cfg.mix_total += cfg.mix[op];
+	if (cfg.mix_total == 0 || cfg.seconds == 0)
+		load_usage();
+
+	threads = calloc(cfg.threads, sizeof(*threads));
+	tids = calloc(cfg.threads, sizeof(*tids));
+	if (!threads || !tids)
+		return -1;
+	pthread_barrier_init(&barrier, NULL, cfg.threads + 1);
+	for (i = 0; i < cfg.threads; i++) {
+		threads[i].cfg = &cfg;
+		threads[i].barrier = &barrier;
+		threads[i].id = i;
+		/*spread the players as evenly as possible */
+		threads[i].nfds = cfg.players / cfg.threads +
+		    (i < cfg.players % cfg.threads);
+		threads[i].fds = calloc(threads[i].nfds, sizeof(int));
+		if (!threads[i].fds ||
+		    pthread_create(&tids[i], NULL, load_thread_fn,
+				   &threads[i]) != 0) {
+			printf("load: could not start thread %u\n", i);
+			exit(1);
+		}
+	}
+
+	pthread_barrier_wait(&barrier);
+	t0 = load_now_ns();
+	sleep(cfg.seconds);
+	__atomic_store_n(&load_stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < cfg.threads; i++)
+		pthread_join(tids[i], NULL);
+	elapsed = (load_now_ns() - t0) / 1e9;
+
+	printf("%u threads, %u players, %u uids%s, %.2f s\n", cfg.threads,
+	       cfg.players, cfg.private_games ? 0 : cfg.uids,
+	       cfg.private_games ? " (private games)" : "", elapsed);
+	printf("%-6s %12s %12s %10s %10s %10s %10s\n", "op", "calls", "calls/s",
+	       "p50 us", "p99 us", "p999 us", "errors");
+	for (op = 0; op < LOAD_NR_OPS; op++) {
+		memset(&total, 0, sizeof(total));
+		for (i = 0; i < cfg.threads; i++) {
+			total.count += threads[i].hist[op].count;
+			total.errors += threads[i].hist[op].errors;
+			for (b = 0; b < LOAD_BUCKETS; b++)
+				total.buckets[b] += threads[i].hist[op].buckets[b];
+		}
+		all += total.count;
+		printf("%-6s %12llu %12.0f %10.2f %10.2f %10.2f %10llu\n",
+		       load_op_names[op], total.count, total.count / elapsed,
+		       load_percentile(&total, 50) / 1e3,
+		       load_percentile(&total, 99) / 1e3,
+		       load_percentile(&total, 99.9) / 1e3, total.errors);
+	}
+	printf("%-6s %12llu %12.0f\n", "total", all, all / elapsed);
+
+	for (i = 0; i < cfg.threads; i++)
+		free(threads[i].fds);
+	free(threads);
+	free(tids);
+	pthread_barrier_destroy(&barrier);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "load") == 0)
+		return load_test(argc - 1, argv + 1) == 0 ? 0 : 1;
+
 	/* Here is an example of sending some data to CS421Net */
 	cs421net_init();
 	cs421net_send("4442", 4);
@@ -194,6 +822,14 @@ int main(void)
 	happy_path_test();
 	illegal_control();
 	overflow_control();
+	private_session_test();
+	batch_test();
+	ioctl_test();
+	poll_test();
+	ring_test();
+	shape_test();
+	few_colors_test();
+	shared_state_test();
 	game_inactive_read();
 	game_inactive_write();
 
@@ -0,0 +1,300 @@
+/**
+ * Compares playing many private /dev/mm games through io_uring
+ * commands against the write()/read() path.
+ *
+ *   mastermind2-uring-test [games] [rounds]
+ *
+ * Every round makes one guess in each of games private games (default
+ * 1000, for 20 rounds): once with one io_uring_enter() per round of
+ * MM_URING_GUESS commands, and once with a write() and a read() per
+ * guess. Won games are started again. Prints guesses per second and
+ * syscalls per guess of each path.
+ *
+ * Talks to io_uring through its raw system calls, so it needs no
+ * liburing; it needs a kernel of 5.19 or later, the first with
+ * IORING_OP_URING_CMD. The module is gated on LINUX_VERSION_CODE for
+ * every later interface change it touches (the shrinker in 6.0 and
+ * 6.7, vm_flags in 6.3, uring_cmd in 6.5 and 6.7, platform remove in
+ * 6.11), so any kernel from 5.19 on runs this test.
+ */
+
+#include "mastermind2.h"
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define PEGS 4
+#define COLORS 6
+
+/* most SQEs submitted per io_uring_enter() */
+#define RING_ENTRIES 1024
+
+struct ring {
+	int fd;
+	unsigned sq_mask;
+	unsigned cq_mask;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+static int ring_init(struct ring *ring, unsigned entries)
+{
+	struct io_uring_params p;
+	size_t sq_len;
+	size_t cq_len;
+	char *sq;
+	char *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(SYS_io_uring_setup, entries, &p);
+	if (ring->fd == -1)
+		return -1;
+	sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP && cq_len > sq_len)
+		sq_len = cq_len;
+	sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		return -1;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cq = sq;
+	else
+		cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_CQ_RING);
+	if (cq == MAP_FAILED)
+		return -1;
+	ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		return -1;
+
+	ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static __u64 random_code(void)
+{
+	__u64 code = 0;
+	int i;
+
+	for (i = 0; i < PEGS; i++)
+		code = code << 4 | rand() % COLORS;
+	return code;
+}
+
+/* open games private games of the default shape */
+static int *open_games(unsigned games)
+{
+	int *fds = calloc(games, sizeof(int));
+	unsigned i;
+
+	if (!fds)
+		return NULL;
+	for (i = 0; i < games; i++) {
+		fds[i] = open("/dev/mm", O_RDWR);
+		if (fds[i] == -1 || ioctl(fds[i], MM_IOC_PRIVATE) == -1) {
+			perror("/dev/mm");
+			return NULL;
+		}
+	}
+	return fds;
+}
+
+/**
+ * uring_rounds() - play the games through MM_URING_* commands
+ * @ring: the ring
+ * @fds: the games
+ * @games: number of @fds
+ * @rounds: guesses per game
+ * @syscalls: *OUT* parameter, io_uring_enter() calls made
+ *
+ * Games won in the last round are started again before returning.
+ *
+ * Return: guesses scored, or -1 on failure
+ */
+static long uring_rounds(struct ring *ring, const int *fds, unsigned games,
+			 unsigned rounds, unsigned long *syscalls)
+{
+	char *won = calloc(games, 1);
+	struct mm_uring_guess guess = { 0 };
+	struct mm_ioc_start start = { 0 };
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned long guesses = 0;
+	unsigned r;
+	unsigned i;
+	unsigned k;
+	unsigned n;
+	unsigned tail;
+	unsigned head;
+
+	if (!won)
+		return -1;
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < games; i += n) {
+			n = games - i < RING_ENTRIES ? games - i : RING_ENTRIES;
+			tail = *ring->sq_tail;
+			for (k = 0; k < n; k++, tail++) {
+				sqe = &ring->sqes[tail & ring->sq_mask];
+				memset(sqe, 0, sizeof(*sqe));
+				sqe->opcode = IORING_OP_URING_CMD;
+				sqe->fd = fds[i + k];
+				sqe->user_data = i + k;
+				if (won[i + k]) {
+					sqe->cmd_op = MM_URING_START;
+					memcpy(sqe->cmd, &start, sizeof(start));
+				} else {
+					sqe->cmd_op = MM_URING_GUESS;
+					guess.code = random_code();
+					memcpy(sqe->cmd, &guess, sizeof(guess));
+				}
+				ring->sq_array[tail & ring->sq_mask] =
+				    tail & ring->sq_mask;
+			}
+			__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+			if (syscall(SYS_io_uring_enter, ring->fd, n, n,
+				    IORING_ENTER_GETEVENTS, NULL, 0) != (long)n) {
+				perror("io_uring_enter");
+				free(won);
+				return -1;
+			}
+			(*syscalls)++;
+
+			head = *ring->cq_head;
+			tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+			for (; head != tail; head++) {
+				cqe = &ring->cqes[head & ring->cq_mask];
+				if (cqe->res < 0) {
+					fprintf(stderr, "command failed: %s\n",
+						strerror(-cqe->res));
+					free(won);
+					return -1;
+				}
+				if (won[cqe->user_data]) {
+					won[cqe->user_data] = 0;
+					continue;
+				}
+				guesses++;
+				won[cqe->user_data] = !(cqe->res & MM_URING_ACTIVE);
+			}
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+		}
+	}
+	/* games won in the last round are still over; leave them going */
+	for (i = 0; i < games; i++) {
+		if (won[i] && ioctl(fds[i], MM_IOC_START, &start) == -1) {
+			perror("MM_IOC_START");
+			free(won);
+			return -1;
+		}
+	}
+	free(won);
+	return guesses;
+}
+
+/* play the games through write() and read(), like uring_rounds() */
+static long rw_rounds(const int *fds, unsigned games, unsigned rounds,
+		      unsigned long *syscalls)
+{
+	struct mm_ioc_start start = { 0 };
+	unsigned long guesses = 0;
+	char buf[PEGS];
+	__u64 code;
+	unsigned r;
+	unsigned i;
+	int k;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < games; i++) {
+			code = random_code();
+			for (k = 0; k < PEGS; k++)
+				buf[k] = '0' + ((code >> (4 * (PEGS - 1 - k))) & 0xf);
+			if (write(fds[i], buf, PEGS) != PEGS ||
+			    read(fds[i], buf, 4) != 4) {
+				perror("/dev/mm");
+				return -1;
+			}
+			*syscalls += 2;
+			guesses++;
+			if (buf[1] - '0' == PEGS) {
+				if (ioctl(fds[i], MM_IOC_START, &start) == -1)
+					return -1;
+				(*syscalls)++;
+			}
+		}
+	}
+	return guesses;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned games = argc > 1 ? atoi(argv[1]) : 1000;
+	unsigned rounds = argc > 2 ? atoi(argv[2]) : 20;
+	unsigned long syscalls = 0;
+	struct ring ring;
+	long guesses;
+	double t0;
+	double elapsed;
+	int *fds;
+
+	if (games == 0 || rounds == 0) {
+		fprintf(stderr, "usage: mastermind2-uring-test [games] "
+			"[rounds]\n");
+		return 2;
+	}
+	fds = open_games(games);
+	if (!fds)
+		return 1;
+	if (ring_init(&ring, RING_ENTRIES) != 0) {
+		perror("io_uring_setup");
+		return 1;
+	}
+
+	t0 = now();
+	guesses = uring_rounds(&ring, fds, games, rounds, &syscalls);
+	elapsed = now() - t0;
+	if (guesses < 0)
+		return 1;
+	printf("io_uring:   %ld guesses in %.3f s, %.0f guesses/s, "
+	       "%.4f syscalls/guess\n", guesses, elapsed, guesses / elapsed,
+	       (double)syscalls / guesses);
+
+	syscalls = 0;
+	t0 = now();
+	guesses = rw_rounds(fds, games, rounds, &syscalls);
+	elapsed = now() - t0;
+	if (guesses < 0)
+		return 1;
+	printf("read/write: %ld guesses in %.3f s, %.0f guesses/s, "
+	       "%.4f syscalls/guess\n", guesses, elapsed, guesses / elapsed,
+	       (double)syscalls / guesses);
+	return 0;
+}
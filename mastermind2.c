@@ -24,445 +24,2377 @@
 
 #include <linux/capability.h>
 #include <linux/cred.h>
+#include <linux/ctype.h>
+#include <linux/debugfs.h>
 #include <linux/fs.h>
 #include <linux/gfp.h>
+#include <linux/hashtable.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
+#include <linux/io_uring.h>
+#include <linux/jiffies.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/random.h>
+#include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
+#include <linux/seqlock.h>
+#include <linux/seq_file.h>
+#include <linux/shrinker.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/uidgid.h>
+#include <linux/uio.h>
+#include <linux/version.h>
 #include <linux/vmalloc.h>
-
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+/* struct io_uring_cmd moved out of <linux/io_uring.h> in 6.7 */
+#include <linux/io_uring/cmd.h>
+#endif
+
+#include "mastermind2.h"
+#include "mastermind2_score.h"
 #include "nf_cs421net.h"
 
+#define CREATE_TRACE_POINTS
+#include "mastermind2_trace.h"
+
 #define NUM_PEGS 4
 #define NUM_COLORS 6
 
 /**
- * mm_num_pegs() - calculate number of black pegs and number of white pegs
- * @target: target code, up to NUM_PEGS elements
- * @guess: user's guess, up to NUM_PEGS elements
- * @num_black: *OUT* parameter, to store calculated number of black pegs
- * @num_white: *OUT* parameter, to store calculated number of white pegs
- *
- * You do not need to modify this function.
+ * mm_count_char() - character for a peg count in a four character
+ * result such as "B2W1"
+ * @n: count, up to MM_MAX_PEGS
  *
+ * Return: '0' to '9', then 'a' for 10 up to 'g' for 16
  */
-static void mm_num_pegs(int target[], int guess[], unsigned *num_black,
-			unsigned *num_white)
+static char mm_count_char(unsigned n)
 {
-	size_t i;
-	size_t j;
-	bool peg_black[NUM_PEGS];
-	bool peg_used[NUM_PEGS];
-
-	*num_black = 0;
-	for (i = 0; i < NUM_PEGS; i++) {
-		if (guess[i] == target[i]) {
-			(*num_black)++;
-			peg_black[i] = true;
-			peg_used[i] = true;
-		} else {
-			peg_black[i] = false;
-			peg_used[i] = false;
-		}
-	}
-
-	*num_white = 0;
-	for (i = 0; i < NUM_PEGS; i++) {
-		if (peg_black[i])
-			continue;
-		for (j = 0; j < NUM_PEGS; j++) {
-			if (guess[i] == target[j] && !peg_used[j]) {
-				peg_used[j] = true;
-				(*num_white)++;
-				break;
-			}
-		}
-	}
+	return n < 10 ? '0' + n : 'a' + n - 10;
 }
 
-/* Copy mm_read(), mm_write(), mm_mmap(), and mm_ctl_write(), along
+/* Copy mm_read_iter(), mm_write_iter(), mm_mmap(), and mm_ctl_write(), along
  * with all of your global variables and helper functions here.
  */
 /* Part 1: YOUR CODE HERE */
 
 #define USER_VIEW_SIZE 4096
 
-/**Sets the limit of the number of colors*/
-static int max_numbers;
+/* most rooms the rooms parameter may ask for */
+#define MM_MAX_ROOMS 64
+
+/* number of rooms, each with its own /dev/mm and /dev/mm_ctl */
+static unsigned int rooms = 1;
+module_param(rooms, uint, 0444);
+MODULE_PARM_DESC(rooms,
+		 "Game rooms; more than 1 creates /dev/mm0.. and /dev/mm_ctl0..");
+
+/* seconds an unused game is kept before it is freed, 0 to keep it */
+static unsigned int idle_timeout = 600;
+module_param(idle_timeout, uint, 0644);
+MODULE_PARM_DESC(idle_timeout,
+		 "Seconds before an unused game is freed (0 = never)");
+
+/* operations on the devices, counted separately in struct mm_stats */
+enum mm_op {
+	MM_OP_OPEN,
+	MM_OP_READ,
+	MM_OP_WRITE,
+	MM_OP_POLL,
+	MM_OP_MMAP,
+	MM_OP_IOCTL,
+	MM_OP_CTL,
+	MM_OP_URING,
+	MM_OP_COUNT
+};
+
+static const char *const mm_op_names[MM_OP_COUNT] = {
+	"open", "read", "write", "poll", "mmap", "ioctl", "ctl", "uring"
+};
+
+/* guess latency bucket i counts guesses that took less than 2^i ns */
+#define MM_LAT_BUCKETS 32
+
+/**
+ * struct mm_stats - game statistics
+ *
+ * Each CPU only updates its own copy with this_cpu_*() operations, so
+ * players never contend on them. Readers add up all copies with
+ * mm_stats_sum(), which may see a slightly stale total.
+ */
+struct mm_stats {
+  /** tracks number of games started */
+	u64 game_count;
+  /** tracks the number of times the code was changed */
+	u64 code_changed;
+  /** tracks number of currently active games; one CPU's copy may be
+   * negative, only the sum is meaningful */
+	long active_games;
+  /** number of guesses scored */
+	u64 guesses;
+  /** calls per operation */
+	u64 ops[MM_OP_COUNT];
+  /** histogram of the time taken to score a guess */
+	u64 guess_latency[MM_LAT_BUCKETS];
+  /** times a player path took a game lock */
+	u64 lock_holds;
+  /** total nanoseconds the game locks were held for @lock_holds */
+	u64 lock_hold_ns;
+  /** games freed because they sat unused for idle_timeout */
+	u64 reclaimed_idle;
+  /** games freed by the shrinker under memory pressure */
+	u64 reclaimed_shrinker;
+  /** valid codes dropped because a later one of the same burst won */
+	u64 codes_superseded;
+};
+
+/**
+ * struct mm_net_stats - CS421Net statistics
+ *
+ * Kept apart from the rooms' struct mm_stats, since a packet does not
+ * necessarily belong to a room. Per CPU like struct mm_stats.
+ */
+struct mm_net_stats {
+  /** tracks the number of invalid attempts to code change */
+	u64 invalid_attempts;
+  /** bottom-half runs that found at least one packet */
+	u64 bursts;
+  /** packets drained by those runs */
+	u64 burst_packets;
+};
 
-/*tracks number of games started*/
-static int game_count = 0;
+static DEFINE_PER_CPU(struct mm_net_stats, mm_net_stats);
 
-/* tracks the number of times the code was changed*/
-static int code_changed = 0;
+/* bump a field of this CPU's struct mm_stats of a room */
+#define mm_stat_inc(room, field) this_cpu_inc((room)->stats->field)
+#define mm_stat_add(room, field, n) this_cpu_add((room)->stats->field, n)
+#define mm_stat_dec(room, field) this_cpu_dec((room)->stats->field)
 
-/*tracks the number of invalid attempts to code change*/
-static int invalid_attempts = 0;
+/* bump a field of this CPU's struct mm_net_stats */
+#define mm_net_stat_inc(field) this_cpu_inc(mm_net_stats.field)
+#define mm_net_stat_add(field, n) this_cpu_add(mm_net_stats.field, n)
 
-/*tracks number of currently active games*/
-static int active_games = 0;
+/* directory of the debugfs files */
+static struct dentry *mm_debugfs;
 
 /*prototypes*/
-static ssize_t mm_read(struct file *filp, char __user * ubuf, size_t count,
-		       loff_t * ppos);
-static ssize_t mm_write(struct file *filp, const char __user * ubuf,
-			size_t count, loff_t * ppos);
+static int mm_open(struct inode *inode, struct file *filp);
+static int mm_release(struct inode *inode, struct file *filp);
+static ssize_t mm_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t mm_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static unsigned int mm_poll(struct file *filp, poll_table * wait);
 static int mm_mmap(struct file *filp, struct vm_area_struct *vma);
+static long mm_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+/* file_operations.uring_cmd exists since 5.19 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+#define MM_HAVE_URING_CMD
+static int mm_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags);
+#endif
 static ssize_t mm_ctl_write(struct file *filp, const char __user * ubuf,
 			    size_t count, loff_t * ppos);
 
 /** handles all /dev/mm file operations */
 static const struct file_operations mm_fops = {
-	.read = mm_read,
-	.write = mm_write,
-	.mmap = mm_mmap
-};
-
-static struct miscdevice mm_device = {
-	.minor = MISC_DYNAMIC_MINOR,
-	.name = "mm",
-	.fops = &mm_fops,
-	.mode = 0666
+	.owner = THIS_MODULE,
+	.open = mm_open,
+	.release = mm_release,
+	.read_iter = mm_read_iter,
+	.write_iter = mm_write_iter,
+	.poll = mm_poll,
+	.mmap = mm_mmap,
+	.unlocked_ioctl = mm_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+#ifdef MM_HAVE_URING_CMD
+	.uring_cmd = mm_uring_cmd,
+#endif
 };
 
 static const struct file_operations mm_ctl_fops = {
+	.owner = THIS_MODULE,
 	.write = mm_ctl_write
 };
 
-static struct miscdevice mm_ctl_device = {
-	.minor = MISC_DYNAMIC_MINOR,
-	.name = "mm_ctl",
-	.fops = &mm_ctl_fops,
-	.mode = 0666
-};
+/**
+ * struct mm_guess_rec - one guess of a game's history
+ *
+ * Text is only rendered from these when a game's view is mapped.
+ */
+struct mm_guess_rec {
+  /** the guess, packed like struct mm_game's @target */
+	u64 pegs;
+  /** the guess's score, packed with MM_SCORE() */
+	u16 score;
+} __packed;
+
+/*
+ * guesses kept per game, about as many as the text of a 4 KiB view
+ * has room for
+ */
+#define MM_HISTORY_LEN 192
+/* records allocated for a game's first guesses, enough for most games */
+#define MM_HISTORY_FIRST 16
 
 /*holds player global variables*/
 struct mm_game {
+  /** protects every field below except @room, @k_id, @is_private,
+   * @ref, @node and @rcu */
+	spinlock_t lock;
   /** true if user is in the middle of a game */
 	bool game_active;
-  /** code that player is trying to guess */
-	int target_code[NUM_PEGS];
+  /** pegs in @target, chosen when the game starts */
+	u8 pegs;
+  /** colors a peg can have, chosen when the game starts */
+	u8 colors;
+  /** code that player is trying to guess, one peg per nibble, the
+   * first peg in the highest nibble used */
+	u64 target;
+  /** code_gen of the room's last broadcast code applied to @target */
+	unsigned long code_gen;
   /** tracks number of guesses user has made */
 	unsigned num_guesses;
   /** result of most recent user guess */
 	char last_result[4];
-  /** buffer that records all of user's guesses and their results */
+  /** score of the most recent guess, packed with MM_SCORE() */
+	u16 last_score;
+  /** scores of the guesses in the most recent write, packed with
+   * MM_SCORE() */
+	u16 batch_scores[MM_MAX_BATCH];
+  /** number of valid entries in @batch_scores */
+	unsigned batch_len;
+  /** bumped whenever a result is scored or the game starts or ends */
+	unsigned result_seq;
+  /** every struct mm_session playing this game */
+	struct list_head sessions;
+  /** the first guesses of the current game, grown by
+   * mm_game_history_grow() up to MM_HISTORY_LEN records */
+	struct mm_guess_rec *history;
+  /** number of records allocated at @history */
+	unsigned history_cap;
+  /** text rendering of @history, one page that is only allocated by
+   * mm_game_view() and only kept up to date while mapped */
 	char *user_view;
   /** use_view offset for the current placement of last_result*/
 	size_t uv_off;
+  /** number of mappings of @user_view */
+	unsigned view_maps;
+  /** mappable history ring, header page followed by the data pages;
+   * only allocated by mm_game_ring() */
+	struct mm_ring_header *ring;
+  /** mappable copy of the state, only allocated by mm_game_shared() */
+	struct mm_shared_state *shared;
+  /** room the game was started in */
+	struct mm_room *room;
   /** identifies the kthread process number*/
 	kuid_t k_id;
-	/* linked list pointer */
-	struct list_head list;
+  /** true if the game belongs to one open file instead of to @k_id */
+	bool is_private;
+  /** true if the game is counted in its room's @reclaimable, see
+   * mm_game_update_reclaimable() */
+	bool reclaimable;
+  /** jiffies when a reference to the game was last dropped */
+	unsigned long last_used;
+  /** one reference for the room's games table (uid games only), plus
+   * one per session and per in-flight user */
+	struct kref ref;
+	/* hash table bucket pointer of a uid game, protected by the room's
+	 * table_lock */
+	struct hlist_node node;
+	/* defers freeing until RCU readers are done with the game */
+	struct rcu_head rcu;
+};
+
+/**
+ * struct mm_session - state of one open file of /dev/mm
+ *
+ * Stored in filp->private_data by mm_open(), so the file's game is
+ * reached without a lookup.
+ */
+struct mm_session {
+  /** room of the /dev/mm node this file opened */
+	struct mm_room *room;
+  /** game this file plays; replaced by MM_IOC_PRIVATE */
+	struct mm_game __rcu *game;
+  /** serializes replacing @game */
+	struct mutex lock;
+  /** entry in the sessions list of @game, protected by its lock */
+	struct list_head game_link;
+  /** pollers of this file. It lives in the session rather than the
+   * game because the file may outlive its game. */
+	wait_queue_head_t wq;
+  /** @result_seq of @game when this file last read it */
+	unsigned seen_result_seq;
+  /** code_gen of @room when this file last read its game */
+	unsigned long seen_code_gen;
+};
+
+/* number of hash buckets is 1 << MM_HASH_BITS */
+#define MM_HASH_BITS 10
+
+/**
+ * struct mm_room - a /dev/mm and /dev/mm_ctl pair with games of its own
+ *
+ * Rooms share nothing but the slab cache and the leaderboard, so
+ * players of different rooms never contend on a lock or a cache line.
+ * With the rooms parameter left at 1 the single room's devices keep
+ * the names /dev/mm and /dev/mm_ctl.
+ */
+struct mm_room {
+  /** index of the room in mm_rooms */
+	unsigned id;
+  /** /dev/mm of the room; mm_open() finds the room from it */
+	struct miscdevice dev;
+  /** /dev/mm_ctl of the room; mm_ctl_write() finds the room from it */
+	struct miscdevice ctl_dev;
+  /** names of @dev and @ctl_dev */
+	char name[8];
+	char ctl_name[12];
+  /** sets the limit of the number of colors of new games */
+	int max_numbers;
+  /** the uid games of the room, hashed by uid. Private games are only
+   * reachable through their file, so they are never in here. */
+	DECLARE_HASHTABLE(games, MM_HASH_BITS);
+  /** serializes insertions into @games. Lookups do not take it; they
+   * walk the buckets under rcu_read_lock() instead. Game state is
+   * protected by each game's own lock. Because the CS421Net handler is
+   * threaded, none of these locks are ever taken from hard interrupt
+   * context and so none of them need to disable interrupts. */
+	spinlock_t table_lock;
+  /** number of uid games in @games, protected by @table_lock */
+	unsigned long table_count;
+  /** uid games in @games that the shrinker could free, for
+   * mm_shrink_count() */
+	atomic_long_t reclaimable;
+  /** bucket of @games that mm_reclaim_games() looks at next */
+	unsigned reclaim_bkt;
+  /** code most recently received over CS421Net for this room. Rather
+   * than rewriting every game, mm_code_publish() stores the code here
+   * once and bumps @code_gen. Each game copies it the next time it is
+   * played, see mm_game_sync_code(). */
+	u64 code;
+	unsigned long code_gen;
+  /** fewest colors a game needs for @code to be a valid code */
+	unsigned code_colors;
+	seqlock_t code_lock;
+  /** pollers waiting for the next broadcast code, see mm_poll() */
+	wait_queue_head_t code_wq;
+  /** the room's statistics, one copy per CPU */
+	struct mm_stats __percpu *stats;
+  /** valid codes for this room in the burst cs421net_bottom() is
+   * draining, and the last of them; only touched by the IRQ thread */
+	unsigned burst_valid;
+	u64 burst_code;
+	unsigned burst_colors;
+};
+
+/* the rooms, created by mastermind_probe() */
+static struct mm_room *mm_rooms;
+static unsigned mm_nr_rooms;
+
+/* games kept on the leaderboard */
+#define MM_BOARD_SIZE 10
+
+/**
+ * struct mm_board_entry - a won game on the leaderboard
+ * @node: node in mm_board, ordered by mm_board_before()
+ * @uid: owner of the game
+ * @guesses: guesses it took to win
+ * @colors: colors of the game's code
+ * @order: when the game was won, to break ties in favor of the first
+ */
+struct mm_board_entry {
+	struct rb_node node;
+	kuid_t uid;
+	unsigned guesses;
+	unsigned colors;
+	u64 order;
 };
 
-static LIST_HEAD(game_globals);
+/*
+ * The leaderboard: the best MM_BOARD_SIZE won games of NUM_PEGS pegs.
+ * Entries come from mm_board_pool, so a win never allocates.
+ * mm_board_lock serializes winners; readers only copy mm_board_snap, a
+ * flat copy of the tree, under its sequence count, so they never make a
+ * player wait.
+ */
+static struct rb_root mm_board = RB_ROOT;
+static struct mm_board_entry mm_board_pool[MM_BOARD_SIZE];
+static unsigned mm_board_used;
+static u64 mm_board_wins;
+/* guesses of the last entry once the board is full, else UINT_MAX */
+static unsigned mm_board_cutoff = UINT_MAX;
+static struct mm_board_entry mm_board_snap[MM_BOARD_SIZE];
+static unsigned mm_board_len;
+static DEFINE_SEQLOCK(mm_board_lock);
+
+/* slab cache that every struct mm_game is allocated from */
+static struct kmem_cache *mm_game_cache;
+
+/**
+ * mm_game_free_rcu() - free a game once no RCU reader can see it
+ * @head: rcu_head embedded in the game
+ */
+static void mm_game_free_rcu(struct rcu_head *head)
+{
+	struct mm_game *game = container_of(head, struct mm_game, rcu);
+
+	if (game->user_view != NULL)
+		free_page((unsigned long)game->user_view);
+	kfree(game->history);
+	/*pages still mapped by a process stay until they are unmapped */
+	vfree(game->ring);
+	if (game->shared != NULL)
+		free_page((unsigned long)game->shared);
+	kmem_cache_free(mm_game_cache, game);
+}
+
+/**
+ * mm_game_release() - kref release callback for struct mm_game
+ * @ref: reference counter embedded in the game
+ */
+static void mm_game_release(struct kref *ref)
+{
+	struct mm_game *game = container_of(ref, struct mm_game, ref);
+
+	call_rcu(&game->rcu, mm_game_free_rcu);
+}
+
+/**
+ * mm_game_put() - drop a reference to a game
+ * @game: game to release
+ */
+static void mm_game_put(struct mm_game *game)
+{
+	WRITE_ONCE(game->last_used, jiffies);
+	kref_put(&game->ref, mm_game_release);
+}
+
+/**
+ * mm_game_lock() - take a game's lock on a player path
+ * @game: game to lock
+ *
+ * Return: time the lock was taken, to be passed to mm_game_unlock()
+ */
+static u64 mm_game_lock(struct mm_game *game)
+{
+	spin_lock(&game->lock);
+	return ktime_get_ns();
+}
+
+/**
+ * mm_game_unlock() - release a lock taken by mm_game_lock()
+ * @game: locked game
+ * @since: return value of mm_game_lock()
+ *
+ * The time the lock was held is added to the statistics.
+ */
+static void mm_game_unlock(struct mm_game *game, u64 since)
+{
+	u64 held = ktime_get_ns() - since;
+
+	spin_unlock(&game->lock);
+	mm_stat_inc(game->room, lock_holds);
+	mm_stat_add(game->room, lock_hold_ns, held);
+}
+
+/**
+ * mm_stat_guesses() - account for scored guesses
+ * @room: room the guesses were made in
+ * @n: number of guesses
+ * @ns: time taken to score all @n of them
+ */
+static void mm_stat_guesses(struct mm_room *room, unsigned n, u64 ns)
+{
+	unsigned bucket;
+
+	if (n == 0)
+		return;
+	bucket = ilog2(div_u64(ns, n) | 1) + 1;
+	if (bucket >= MM_LAT_BUCKETS)
+		bucket = MM_LAT_BUCKETS - 1;
+	mm_stat_add(room, guesses, n);
+	mm_stat_add(room, guess_latency[bucket], n);
+}
+
+/**
+ * mm_game_alloc() - allocate and initialize a game
+ * @room: room the game is played in
+ * @uid: user that will play the game
+ *
+ * Return: the new game holding one reference, or NULL on failure
+ */
+static struct mm_game *mm_game_alloc(struct mm_room *room, kuid_t uid)
+{
+	struct mm_game *game;
+
+	game = kmem_cache_zalloc(mm_game_cache, GFP_KERNEL);
+	if (!game) {
+		pr_err("Could not allocate memory for a game\n");
+		return NULL;
+	}
+	spin_lock_init(&game->lock);
+	INIT_LIST_HEAD(&game->sessions);
+	kref_init(&game->ref);
+	game->room = room;
+	game->k_id = uid;
+	return game;
+}
+
+/**
+ * mm_game_update_reclaimable() - keep the room's count of reclaimable
+ * games current
+ * @game: game whose state just changed, whose lock must be held
+ *
+ * A uid game that is not in progress, is played by no file and is not
+ * mapped can be freed under memory pressure, unless a call happens to
+ * hold it right then. Called whenever one of those conditions changes.
+ */
+static void mm_game_update_reclaimable(struct mm_game *game)
+{
+	bool reclaimable = !game->is_private && !game->game_active &&
+	    list_empty(&game->sessions) && !game->view_maps;
+
+	if (reclaimable == game->reclaimable)
+		return;
+	game->reclaimable = reclaimable;
+	if (reclaimable)
+		atomic_long_inc(&game->room->reclaimable);
+	else
+		atomic_long_dec(&game->room->reclaimable);
+}
+
+/**
+ * mm_lookup_game() - find the game belonging to a uid
+ * @room: room to look in
+ * @uid: user whose game to find
+ *
+ * Return: the player's game with a reference held, or NULL if @uid
+ * has none yet in @room
+ */
+static struct mm_game *mm_lookup_game(struct mm_room *room, kuid_t uid)
+{
+	struct mm_game *retval;
 
-/*spinlock to protect global variables*/
-static DEFINE_SPINLOCK(mm_spinlock);
+	rcu_read_lock();
+	hash_for_each_possible_rcu(room->games, retval, node,
+				   __kuid_val(uid)) {
+		/*compare uid */
+		if (uid_eq(retval->k_id, uid) &&
+		    kref_get_unless_zero(&retval->ref)) {
+			rcu_read_unlock();
+			return retval;
+		}
+	}
+	rcu_read_unlock();
+	return NULL;
+}
 
 /**
  * mm_find_game() - function that returns global vars given a uid
- *-if global is unallocated then allocate it with kmalloc
+ *-if global is unallocated then allocate it from mm_game_cache
  *-set uid as long as globals are alloc'd
- *-doesn't use locking so calling function MUST hold lock before call.
+ *-takes the room's table_lock itself, so callers must not hold any
+ * lock.
+ *@room: room of the game
  *@uid: process id for the game youre accessing
  *
+ * Only the bucket that @uid hashes to is searched, so the cost of a
+ * lookup does not grow with the number of players. A new game is
+ * allocated before table_lock is taken; if another process with
+ * the same uid inserted one in the meantime, that one is reused and
+ * the new allocation is returned to the cache.
+ *
+ * The caller owns a reference to the returned game and must drop it
+ * with mm_game_put().
+ *
  *RETURN: the pointer to a mm_game struct, or 0 if it cant alloc
  */
-static struct mm_game *mm_find_game(kuid_t uid)
+static struct mm_game *mm_find_game(struct mm_room *room, kuid_t uid)
 {
 	struct mm_game *retval;
+	struct mm_game *new_game;
 
-	list_for_each_entry(retval, &game_globals, list) {
-		if (retval == NULL) {
-			retval = kmalloc(sizeof(*retval), GFP_KERNEL);
-			if (!retval) {
-				pr_err
-				    ("Could not allocate memory for game_globals\n");
-				return 0;
-			}
-			retval->user_view = vmalloc(PAGE_SIZE);
-			if (!retval->user_view) {
-				pr_err
-				    ("Could not allocate memory for user_view\n");
-				return 0;
-			}
-			retval->k_id = uid;
-			list_add(&retval->list, &game_globals);
-			active_games++;
-			return retval;
-		}
+	retval = mm_lookup_game(room, uid);
+	if (retval)
+		return retval;
 
-		/*compare uid */
+	new_game = mm_game_alloc(room, uid);
+	if (!new_game)
+		return 0;
+
+	spin_lock(&room->table_lock);
+	/* another process with the same uid may have won the race */
+	hash_for_each_possible(room->games, retval, node, __kuid_val(uid)) {
 		if (uid_eq(retval->k_id, uid)) {
+			kref_get(&retval->ref);
+			spin_unlock(&room->table_lock);
+			kmem_cache_free(mm_game_cache, new_game);
 			return retval;
 		}
 	}
+	/* the initial reference belongs to the games table */
+	kref_get(&new_game->ref);
+	/*nobody else can see the game yet, so its lock is not needed */
+	mm_game_update_reclaimable(new_game);
+	hash_add_rcu(room->games, &new_game->node, __kuid_val(uid));
+	room->table_count++;
+	spin_unlock(&room->table_lock);
+	return new_game;
+}
 
-	retval = kmalloc(sizeof(*retval), GFP_KERNEL);
-	if (!retval) {
-		pr_err("Could not allocate memory for game_globals\n");
-		return 0;
+/**
+ * mm_game_try_reclaim() - free a uid game if nobody is using it
+ * @game: uid game in its room's table, whose table_lock must be held
+ *
+ * Only succeeds if the table holds the last reference: no file plays
+ * the game, nothing maps its view, and no call is in progress.
+ * Dropping that reference under table_lock means no lookup can
+ * revive the game afterwards, since mm_lookup_game() only takes
+ * references that are not zero.
+ *
+ * Return: true if @game was unhashed and will be freed
+ */
+static bool mm_game_try_reclaim(struct mm_game *game)
+{
+	if (!refcount_dec_if_one(&game->ref.refcount))
+		return false;
+	hash_del_rcu(&game->node);
+	game->room->table_count--;
+	if (game->reclaimable)
+		atomic_long_dec(&game->room->reclaimable);
+	/*no one else can see the game now */
+	if (game->game_active)
+		mm_stat_dec(game->room, active_games);
+	call_rcu(&game->rcu, mm_game_free_rcu);
+	return true;
+}
+
+/**
+ * mm_reclaim_games() - free uid games of a room that nobody is using
+ * @room: room to look in
+ * @nr: most games to look at
+ * @want: returns true for the games that may be freed
+ * @scanned: *OUT* parameter, number of games looked at
+ *
+ * Starts at the room's reclaim_bkt and wraps around, so each call picks
+ * up where the last one stopped rather than looking at the same
+ * buckets again; at most one pass over the table is made. The room's
+ * table_lock is only held for one bucket at a time, so players are not
+ * stalled for a scan of the whole table.
+ *
+ * Return: number of games freed
+ */
+static unsigned long mm_reclaim_games(struct mm_room *room, unsigned long nr,
+				      bool (*want)(const struct mm_game *),
+				      unsigned long *scanned)
+{
+	struct hlist_node *tmp;
+	struct mm_game *game;
+	unsigned long freed = 0;
+	unsigned bkt = READ_ONCE(room->reclaim_bkt);
+	unsigned n;
+
+	*scanned = 0;
+	for (n = 0; n < HASH_SIZE(room->games) && *scanned < nr; n++) {
+		spin_lock(&room->table_lock);
+		hlist_for_each_entry_safe(game, tmp, &room->games[bkt], node) {
+			if (*scanned == nr)
+				break;
+			(*scanned)++;
+			if (want(game) && mm_game_try_reclaim(game))
+				freed++;
+		}
+		spin_unlock(&room->table_lock);
+		/*a bucket left half done is looked at again next time */
+		if (*scanned < nr)
+			bkt = (bkt + 1) % HASH_SIZE(room->games);
+		cond_resched();
 	}
-	retval->user_view = vmalloc(PAGE_SIZE);
-	if (!retval->user_view) {
-		pr_err("Could not allocate memory for user_view\n");
-		return 0;
+	WRITE_ONCE(room->reclaim_bkt, bkt);
+	return freed;
+}
+
+/* how often idle games are looked for */
+#define MM_REAP_INTERVAL (60 * HZ)
+
+/**
+ * mm_game_idle() - whether a game has been unused for idle_timeout
+ * @game: game to check
+ *
+ * Return: true if @game may be reclaimed as idle
+ */
+static bool mm_game_idle(const struct mm_game *game)
+{
+	unsigned long timeout = READ_ONCE(idle_timeout) * HZ;
+
+	return timeout &&
+	    time_after(jiffies, READ_ONCE(game->last_used) + timeout);
+}
+
+static void mm_reap_idle(struct work_struct *work);
+static DECLARE_DELAYED_WORK(mm_reap_work, mm_reap_idle);
+
+/**
+ * mm_reap_idle() - free the games that sat unused for idle_timeout
+ * @work: mm_reap_work
+ *
+ * Runs every MM_REAP_INTERVAL until the driver is removed. A game in
+ * progress is freed as well, so a player who walks away without
+ * quitting does not pin their game forever.
+ */
+static void mm_reap_idle(struct work_struct *work)
+{
+	struct mm_room *room;
+	unsigned long scanned;
+	unsigned i;
+
+	for (i = 0; i < mm_nr_rooms && READ_ONCE(idle_timeout); i++) {
+		room = &mm_rooms[i];
+		mm_stat_add(room, reclaimed_idle,
+			    mm_reclaim_games(room, ULONG_MAX, mm_game_idle,
+					     &scanned));
 	}
-	retval->k_id = uid;
-	list_add(&retval->list, &game_globals);
-	active_games++;
-	return retval;
+	schedule_delayed_work(&mm_reap_work, MM_REAP_INTERVAL);
+}
+
+/**
+ * mm_game_inactive() - whether a game has no game in progress
+ * @game: game to check
+ *
+ * Return: true if @game may be reclaimed under memory pressure
+ */
+static bool mm_game_inactive(const struct mm_game *game)
+{
+	return !READ_ONCE(game->game_active);
+}
+
+/* report the uid games that mm_shrink_scan() could free right now */
+static unsigned long mm_shrink_count(struct shrinker *shrink,
+				     struct shrink_control *sc)
+{
+	unsigned long count = 0;
+	unsigned i;
+
+	for (i = 0; i < mm_nr_rooms; i++)
+		count += atomic_long_read(&mm_rooms[i].reclaimable);
+	return count;
 }
 
+/* room mm_shrink_scan() starts in next */
+static unsigned mm_shrink_room;
+
 /**
- * mm_free_games() - frees all game memory
+ * mm_shrink_scan() - free unused games under memory pressure
+ * @shrink: the shrinker registered by mm_shrinker_register()
+ * @sc: how many games to look at; nr_scanned gets how many were
  *
- *@void: process id for the game youre accessing
+ * Only games without a game in progress are freed, so players lose
+ * nothing but their history. Rooms take turns at being looked at
+ * first, and each resumes at the bucket it stopped at, so repeated
+ * calls work through the tables instead of rescanning their start.
  *
- * return void
+ * Return: number of games freed, or SHRINK_STOP if none could be
  */
-static void mm_free_games(void)
+static unsigned long mm_shrink_scan(struct shrinker *shrink,
+				    struct shrink_control *sc)
 {
-	struct list_head *game_vars;
-	struct list_head *tmp;
-	struct mm_game *cont;
+	struct mm_room *room;
+	unsigned long freed = 0;
+	unsigned long scanned = 0;
+	unsigned long n;
+	unsigned long s;
+	unsigned first;
+	unsigned i;
+
+	if (!mm_nr_rooms)
+		return SHRINK_STOP;
+	first = READ_ONCE(mm_shrink_room) % mm_nr_rooms;
+	WRITE_ONCE(mm_shrink_room, first + 1);
+	for (i = 0; i < mm_nr_rooms && scanned < sc->nr_to_scan; i++) {
+		room = &mm_rooms[(first + i) % mm_nr_rooms];
+		n = mm_reclaim_games(room, sc->nr_to_scan - scanned,
+				     mm_game_inactive, &s);
+		mm_stat_add(room, reclaimed_shrinker, n);
+		freed += n;
+		scanned += s;
+	}
+	sc->nr_scanned = scanned;
+	return freed ? freed : SHRINK_STOP;
+}
 
-	list_for_each_safe(game_vars, tmp, &game_globals) {
-		cont = container_of(game_vars, struct mm_game, list);
-		if (cont->user_view != NULL) {
-			vfree(cont->user_view);
-			cont->user_view = NULL;
-		}
-		kfree(cont);
-		cont = NULL;
+/*
+ * Up to 6.6 a shrinker is a static struct passed to register_shrinker(),
+ * which takes a name format from 6.0 on; 6.7 replaced that with
+ * shrinker_alloc() and shrinker_register().
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static struct shrinker *mm_shrinker;
+
+/**
+ * mm_shrinker_register() - let the kernel reclaim games under pressure
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_shrinker_register(void)
+{
+	mm_shrinker = shrinker_alloc(0, "mastermind");
+	if (!mm_shrinker)
+		return -ENOMEM;
+	mm_shrinker->count_objects = mm_shrink_count;
+	mm_shrinker->scan_objects = mm_shrink_scan;
+	mm_shrinker->seeks = DEFAULT_SEEKS;
+	shrinker_register(mm_shrinker);
+	return 0;
+}
+
+/* undo mm_shrinker_register() */
+static void mm_shrinker_unregister(void)
+{
+	shrinker_free(mm_shrinker);
+}
+#else
+static struct shrinker mm_shrinker = {
+	.count_objects = mm_shrink_count,
+	.scan_objects = mm_shrink_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/**
+ * mm_shrinker_register() - let the kernel reclaim games under pressure
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_shrinker_register(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	return register_shrinker(&mm_shrinker, "mastermind");
+#else
+	return register_shrinker(&mm_shrinker);
+#endif
+}
+
+/* undo mm_shrinker_register() */
+static void mm_shrinker_unregister(void)
+{
+	unregister_shrinker(&mm_shrinker);
+}
+#endif
+
+/**
+ * mm_game_view() - get a game's user_view, allocating it on first use
+ * @game: game whose view is wanted
+ *
+ * Players that never map their view never need the page. Once
+ * installed the page stays until the game is freed.
+ *
+ * Must be called without @game's lock held, since it may sleep.
+ *
+ * Return: the zero-filled page backing @game's view, or NULL if it
+ * could not be allocated
+ */
+static char *mm_game_view(struct mm_game *game)
+{
+	unsigned long page;
+	char *view;
+
+	view = smp_load_acquire(&game->user_view);
+	if (view)
+		return view;
+
+	page = get_zeroed_page(GFP_KERNEL);
+	if (!page) {
+		pr_err("Could not allocate memory for user_view\n");
+		return NULL;
+	}
+	view = cmpxchg(&game->user_view, NULL, (char *)page);
+	if (view) {
+		free_page(page);
+		return view;
 	}
+	return (char *)page;
 }
 
+/* bytes of history the ring holds */
+#define MM_RING_SIZE (MM_RING_PAGES * PAGE_SIZE)
+
 /**
- * mm_read() - callback invoked when a process reads from
- * /dev/mm
- * @filp: process's file object that is reading from this device (ignored)
- * @ubuf: destination buffer to store output
- * @count: number of bytes in @ubuf
- * @ppos: file offset (in/out parameter)
+ * mm_game_ring() - get a game's history ring, allocating it on first use
+ * @game: game whose ring is wanted
  *
- * Write to @ubuf the last result of the game, offset by
- * @ppos. Copy the lesser of @count and (string length of @last_result
- * - *@ppos). Then increment the value pointed to by @ppos by the
- * number of bytes copied. If @ppos is greater than or equal to the
- * length of @last_result, then copy nothing.
+ * Only games whose history is streamed pay for the ring. It records
+ * the guesses made after it was allocated.
  *
- * If no game is active, instead copy to @ubuf up to four '?'
- * characters.
+ * Must be called without @game's lock held, since it may sleep.
  *
- * Return: number of bytes written to @ubuf, or negative on error
+ * Return: the ring, or NULL if it could not be allocated
  */
-static ssize_t mm_read(struct file *filp, char __user * ubuf, size_t count,
-		       loff_t * ppos)
+static struct mm_ring_header *mm_game_ring(struct mm_game *game)
 {
-	unsigned long flags;
-	size_t num_bytes = count;
-	char *q = "????";
-	struct mm_game *game_vars;
+	struct mm_ring_header *ring;
+	struct mm_ring_header *old;
+
+	ring = smp_load_acquire(&game->ring);
+	if (ring)
+		return ring;
+
+	/*zeroed, and suitable for remap_vmalloc_range() */
+	ring = vmalloc_user(PAGE_SIZE + MM_RING_SIZE);
+	if (!ring) {
+		pr_err("Could not allocate memory for the history ring\n");
+		return NULL;
+	}
+	ring->size = MM_RING_SIZE;
+	ring->data_offset = PAGE_SIZE;
+	old = cmpxchg(&game->ring, NULL, ring);
+	if (old) {
+		vfree(ring);
+		return old;
+	}
+	return ring;
+}
 
-	spin_lock_irqsave(&mm_spinlock, flags);
-	game_vars = mm_find_game(current_uid());
-	spin_unlock_irqrestore(&mm_spinlock, flags);
+/**
+ * mm_ring_write() - append to a game's history ring
+ * @ring: the ring, whose game's lock must be held
+ * @buf: bytes to append
+ * @len: number of bytes in @buf, at most MM_RING_SIZE
+ *
+ * When the ring is full the oldest bytes are overwritten. @tail is
+ * advanced before that happens and @head only after the new bytes are
+ * in place, so a reader can tell which of the bytes it copied are
+ * still valid.
+ */
+static void mm_ring_write(struct mm_ring_header *ring, const char *buf,
+			  size_t len)
+{
+	char *data = (char *)ring + PAGE_SIZE;
+	u32 head = ring->head;
+	u32 off = head % MM_RING_SIZE;
+	size_t chunk = min_t(size_t, len, MM_RING_SIZE - off);
+
+	if (head + len - ring->tail > MM_RING_SIZE) {
+		WRITE_ONCE(ring->tail, head + len - MM_RING_SIZE);
+		smp_wmb();
+	}
+	memcpy(data + off, buf, chunk);
+	memcpy(data, buf + chunk, len - chunk);
+	smp_store_release(&ring->head, head + len);
+}
 
-	if (game_vars == 0)
-		return 0;
+/**
+ * mm_format_guess() - render one guess of a game's history as text
+ * @buf: *OUT* parameter, receives the text
+ * @size: size of @buf
+ * @n: guess number, starting at 1
+ * @pegs: pegs in the game's code
+ * @rec: the guess
+ *
+ * Pegs are written as hexadecimal digits, so a game of the default
+ * shape reads as it always did.
+ *
+ * Return: number of characters written to @buf
+ */
+static size_t mm_format_guess(char *buf, size_t size, unsigned n,
+			      unsigned pegs, const struct mm_guess_rec *rec)
+{
+	size_t len;
+
+	len = scnprintf(buf, size, "Guess %u: %0*llx | B%uW%u\n", n, pegs,
+			rec->pegs, MM_SCORE_BLACK(rec->score),
+			MM_SCORE_WHITE(rec->score));
+	if (MM_SCORE_BLACK(rec->score) == pegs)
+		len += scnprintf(buf + len, size - len,
+				 "You won the game!\n");
+	return len;
+}
 
-	if (*ppos > 0)
-		return 0;
+/**
+ * mm_view_append() - append text to a game's view
+ * @game: game, whose lock must be held and whose view is allocated
+ * @line: text to append
+ * @len: length of @line
+ *
+ * Whatever does not fit in the page is dropped.
+ */
+static void mm_view_append(struct mm_game *game, const char *line,
+			   size_t len)
+{
+	size_t room = PAGE_SIZE - 1 - game->uv_off;
 
-	spin_lock_irqsave(&mm_spinlock, flags);
-	if (game_vars->game_active) {
-		spin_unlock_irqrestore(&mm_spinlock, flags);
+	len = min(len, room);
+	memcpy(game->user_view + game->uv_off, line, len);
+	game->uv_off += len;
+}
 
-		if (NUM_PEGS > *ppos) {
+/**
+ * mm_game_render() - render a game's history into its view
+ * @game: game, whose lock must be held and whose view is allocated
+ *
+ * Called when the view gets mapped; while it stays mapped,
+ * mm_game_guess() appends each new guess itself.
+ */
+static void mm_game_render(struct mm_game *game)
+{
+	char line[64];
+	unsigned n = min(game->num_guesses, game->history_cap);
+	unsigned i;
+
+	memset(game->user_view, 0, USER_VIEW_SIZE);
+	game->uv_off = 0;
+	for (i = 0; i < n; i++)
+		mm_view_append(game, line,
+			       mm_format_guess(line, sizeof(line), i + 1,
+					       game->pegs, &game->history[i]));
+}
 
-			if (NUM_PEGS - *ppos < count)
-				num_bytes = NUM_PEGS - *ppos;
-			spin_lock_irqsave(&mm_spinlock, flags);
-			if (copy_to_user
-			    (ubuf + *ppos, game_vars->last_result,
-			     num_bytes) != 0) {
-				spin_unlock_irqrestore(&mm_spinlock, flags);
-				return 0;
-			}
-			spin_unlock_irqrestore(&mm_spinlock, flags);
-			*ppos += num_bytes;
-			return num_bytes;
-		}
-		return 0;
+/**
+ * mm_game_history_grow() - make room for more guesses in a game's history
+ * @game: game, whose lock must be held
+ *
+ * Starts at MM_HISTORY_FIRST records and doubles up to MM_HISTORY_LEN,
+ * so a short game does not pay for the longest history it could have.
+ * The records are kept across games. Called under the game lock, so it
+ * cannot sleep; if it fails, @history_cap stays as it was and the rest
+ * of the game's guesses are not recorded.
+ */
+static void mm_game_history_grow(struct mm_game *game)
+{
+	unsigned cap = game->history_cap ?
+	    min_t(unsigned, 2 * game->history_cap, MM_HISTORY_LEN) :
+	    MM_HISTORY_FIRST;
+	struct mm_guess_rec *history;
+
+	history = krealloc(game->history, cap * sizeof(*history), GFP_NOWAIT);
+	if (!history)
+		return;
+	game->history = history;
+	game->history_cap = cap;
+}
 
-	} else {
-		spin_unlock_irqrestore(&mm_spinlock, flags);
-		if (copy_to_user(ubuf + *ppos, q, NUM_PEGS) != 0) {
-			return 0;
-		}
-		*ppos += NUM_PEGS;
-		return NUM_PEGS;
+/**
+ * mm_game_publish() - update a game's shared state page
+ * @game: game, whose lock must be held
+ *
+ * Follows the seqcount protocol: @seq is odd while the fields change,
+ * and readers retry until they see the same even @seq before and after
+ * their copy. The game lock keeps writers from overlapping.
+ */
+static void mm_game_publish(struct mm_game *game)
+{
+	struct mm_shared_state *shared = game->shared;
+
+	if (!shared)
+		return;
+	WRITE_ONCE(shared->seq, shared->seq + 1);
+	smp_wmb();
+	WRITE_ONCE(shared->num_guesses, game->num_guesses);
+	memcpy(shared->last_result, game->last_result, 4);
+	WRITE_ONCE(shared->game_active, game->game_active);
+	WRITE_ONCE(shared->pegs, game->pegs);
+	WRITE_ONCE(shared->colors, game->colors);
+	WRITE_ONCE(shared->code_gen, game->code_gen);
+	smp_wmb();
+	WRITE_ONCE(shared->seq, shared->seq + 1);
+}
+
+/**
+ * mm_game_shared() - get a game's shared state page, allocating it on
+ * first use
+ * @game: game whose page is wanted
+ *
+ * Must be called without @game's lock held, since it may sleep.
+ *
+ * Return: the page, or NULL if it could not be allocated
+ */
+static struct mm_shared_state *mm_game_shared(struct mm_game *game)
+{
+	unsigned long page;
+	struct mm_shared_state *shared;
+
+	shared = smp_load_acquire(&game->shared);
+	if (shared)
+		return shared;
+
+	page = get_zeroed_page(GFP_KERNEL);
+	if (!page) {
+		pr_err("Could not allocate memory for the shared state\n");
+		return NULL;
+	}
+	shared = cmpxchg(&game->shared, NULL, (struct mm_shared_state *)page);
+	if (shared) {
+		free_page(page);
+		return shared;
+	}
+
+	/*fill it in before anyone maps it */
+	spin_lock(&game->lock);
+	mm_game_publish(game);
+	spin_unlock(&game->lock);
+	return (struct mm_shared_state *)page;
+}
+
+/**
+ * mm_game_start() - start a new game, restarting any game in progress
+ * @game: game to start, whose lock must be held
+ * @pegs: pegs in the code, 1 to MM_MAX_PEGS
+ * @colors: colors of the code, 2 to MM_MAX_COLORS
+ *
+ * A game of NUM_PEGS pegs and more than 4 colors starts with the code
+ * 4211, as it always did, until a code is broadcast. Games of any other
+ * shape start with a random code instead, since 4211 is not a valid
+ * code with 4 colors or fewer.
+ */
+static void mm_game_start(struct mm_game *game, unsigned pegs,
+			  unsigned colors)
+{
+	struct mm_room *room = game->room;
+	unsigned i;
+
+	mm_stat_inc(room, game_count);
+	if (!game->game_active)
+		mm_stat_inc(room, active_games);
+
+	game->pegs = pegs;
+	game->colors = colors;
+	if (pegs == NUM_PEGS && colors > 4) {
+		game->target = 0x4211;
+	} else {
+		game->target = 0;
+		for (i = 0; i < pegs; i++)
+			game->target = game->target << 4 |
+			    get_random_u32() % colors;
+	}
+	/*codes broadcast before the game started do not apply to it */
+	game->code_gen = READ_ONCE(room->code_gen);
+
+	game->num_guesses = 0;
+	game->game_active = true;
+	mm_game_update_reclaimable(game);
+	game->last_result[0] = 'B';
+	game->last_result[1] = '-';
+	game->last_result[2] = 'W';
+	game->last_result[3] = '-';
+	game->batch_len = 0;
+
+	/*reset userview byte offset */
+	if (game->view_maps)
+		mm_game_render(game);
+	/*the ring keeps older games, so mark where this one begins */
+	if (game->ring)
+		mm_ring_write(game->ring, "New game\n", 9);
+	mm_game_publish(game);
+	trace_mm_game_start(game, game->k_id, 0);
+}
+
+/**
+ * mm_game_quit() - end a game, if one is in progress
+ * @game: game to end, whose lock must be held
+ */
+static void mm_game_quit(struct mm_game *game)
+{
+	if (game->game_active) {
+		game->game_active = false;
+		mm_game_update_reclaimable(game);
+		/*a quit game has no results left to read */
+		game->batch_len = 0;
+		mm_stat_dec(game->room, active_games);
+		trace_mm_game_quit(game, game->k_id, game->num_guesses);
+		mm_game_publish(game);
+	}
+}
+
+/**
+ * mm_game_sync_code() - apply the latest code broadcast to a game's room
+ * @game: game, whose lock must be held
+ *
+ * Cheap when nothing was broadcast since the game last looked: a
+ * single comparison of generation numbers.
+ *
+ * Broadcast codes have NUM_PEGS pegs, so they only apply to games of
+ * that many pegs with enough colors for every peg of the code. Other
+ * games keep their own code.
+ */
+static void mm_game_sync_code(struct mm_game *game)
+{
+	struct mm_room *room = game->room;
+	unsigned seq;
+	u64 code;
+	unsigned colors;
+
+	if (game->code_gen == READ_ONCE(room->code_gen))
+		return;
+	do {
+		seq = read_seqbegin(&room->code_lock);
+		code = room->code;
+		colors = room->code_colors;
+		game->code_gen = room->code_gen;
+	} while (read_seqretry(&room->code_lock, seq));
+	if (game->pegs == NUM_PEGS && colors <= game->colors)
+		game->target = code;
+	mm_game_publish(game);
+}
+
+/* true if @a ranks above @b: fewer guesses, then more colors, then first */
+static bool mm_board_before(const struct mm_board_entry *a,
+			    const struct mm_board_entry *b)
+{
+	if (a->guesses != b->guesses)
+		return a->guesses < b->guesses;
+	if (a->colors != b->colors)
+		return a->colors > b->colors;
+	return a->order < b->order;
+}
+
+/**
+ * mm_board_add() - rank a won game on the leaderboard
+ * @game: game that was just won, whose lock must be held
+ *
+ * Only games of NUM_PEGS pegs are ranked, since fewer pegs are easier.
+ * A game with more guesses than every entry of a full board is turned
+ * away without taking mm_board_lock. Otherwise it is inserted in
+ * O(log MM_BOARD_SIZE), reusing the last entry if the board is full,
+ * and the snapshot that readers copy is refreshed.
+ */
+static void mm_board_add(struct mm_game *game)
+{
+	struct rb_node **link = &mm_board.rb_node;
+	struct rb_node *parent = NULL;
+	struct mm_board_entry new;
+	struct mm_board_entry *entry;
+	struct rb_node *node;
+	unsigned i;
+
+	if (game->pegs != NUM_PEGS ||
+	    game->num_guesses > READ_ONCE(mm_board_cutoff))
+		return;
+
+	write_seqlock(&mm_board_lock);
+	new.uid = game->k_id;
+	new.guesses = game->num_guesses;
+	new.colors = game->colors;
+	new.order = mm_board_wins++;
+	if (mm_board_used < MM_BOARD_SIZE) {
+		entry = &mm_board_pool[mm_board_used++];
+	} else {
+		entry = rb_entry(rb_last(&mm_board), struct mm_board_entry,
+				 node);
+		if (!mm_board_before(&new, entry))
+			goto out;
+		rb_erase(&entry->node, &mm_board);
+	}
+	entry->uid = new.uid;
+	entry->guesses = new.guesses;
+	entry->colors = new.colors;
+	entry->order = new.order;
+
+	while (*link) {
+		parent = *link;
+		if (mm_board_before(entry, rb_entry(parent,
+						    struct mm_board_entry,
+						    node)))
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&entry->node, parent, link);
+	rb_insert_color(&entry->node, &mm_board);
+
+	i = 0;
+	for (node = rb_first(&mm_board); node; node = rb_next(node))
+		mm_board_snap[i++] = *rb_entry(node, struct mm_board_entry,
+					       node);
+	mm_board_len = i;
+	if (i == MM_BOARD_SIZE)
+		WRITE_ONCE(mm_board_cutoff, mm_board_snap[i - 1].guesses);
+out:
+	write_sequnlock(&mm_board_lock);
+}
+
+/**
+ * mm_game_guess() - score one guess and record it
+ * @game: active game, whose lock must be held
+ * @guess: the guess, @game's pegs packed like its target
+ *
+ * Update @num_guesses, @last_result, and @history. Text is only
+ * formatted if the view is mapped or the history ring is allocated. If
+ * the guess matches the target code, the game is won, ranked with
+ * mm_board_add(), and ends.
+ *
+ * Return: the guess's score, packed with MM_SCORE()
+ */
+static u16 mm_game_guess(struct mm_game *game, u64 guess)
+{
+	unsigned black;
+	unsigned white;
+	struct mm_guess_rec rec;
+	char line[64];
+	size_t len;
+
+	/*get number of black and white pegs */
+	mm_game_sync_code(game);
+	mm_num_pegs(game->target, guess, game->pegs, &black, &white);
+
+	/*update last result */
+	game->last_result[1] = mm_count_char(black);
+	game->last_result[3] = mm_count_char(white);
+
+	/*updates num guesses */
+	game->num_guesses++;
+	rec.pegs = guess;
+	rec.score = MM_SCORE(black, white);
+	game->last_score = rec.score;
+	trace_mm_guess(game, game->k_id, game->num_guesses, game->pegs,
+		       guess, black, white);
+
+	/*update history, which must stay a prefix of the game's guesses */
+	if (game->num_guesses - 1 == game->history_cap &&
+	    game->history_cap < MM_HISTORY_LEN)
+		mm_game_history_grow(game);
+	if (game->num_guesses <= game->history_cap)
+		game->history[game->num_guesses - 1] = rec;
+	if (game->view_maps || game->ring) {
+		len = mm_format_guess(line, sizeof(line), game->num_guesses,
+				      game->pegs, &rec);
+		if (game->view_maps)
+			mm_view_append(game, line, len);
+		if (game->ring)
+			mm_ring_write(game->ring, line, len);
+	}
+
+	if (black == game->pegs) {
+		trace_mm_game_win(game, game->k_id, game->num_guesses);
+		mm_board_add(game);
+		mm_game_quit(game);
+	} else {
+		mm_game_publish(game);
+	}
+	return rec.score;
+}
+
+/**
+ * mm_game_notify() - wake up everyone polling a game's files
+ * @game: game, whose lock must be held
+ * @mask: POLLIN when a result was scored or the game started or ended,
+ * and also POLLOUT when the game started
+ *
+ * New codes are announced to all pollers of a room at once through
+ * its code_wq.
+ */
+static void mm_game_notify(struct mm_game *game, unsigned int mask)
+{
+	struct mm_session *session;
+
+	if (mask & POLLIN)
+		game->result_seq++;
+	list_for_each_entry(session, &game->sessions, game_link)
+	    wake_up_interruptible_poll(&session->wq, mask);
+}
+
+/**
+ * mm_session_attach() - make a session play a game
+ * @session: session without a game
+ * @game: game to play; the session takes over the caller's reference
+ */
+static void mm_session_attach(struct mm_session *session, struct mm_game *game)
+{
+	spin_lock(&game->lock);
+	list_add(&session->game_link, &game->sessions);
+	mm_game_update_reclaimable(game);
+	session->seen_result_seq = game->result_seq;
+	session->seen_code_gen = READ_ONCE(game->room->code_gen);
+	spin_unlock(&game->lock);
+	rcu_assign_pointer(session->game, game);
+}
+
+/**
+ * mm_session_detach() - stop a session from playing its game
+ * @session: session of the file
+ * @game: the game @session plays
+ *
+ * A private game has no other player, so it is ended here; a uid game
+ * lives on in its room. The caller still has to
+ * drop the session's reference to @game, once @session no longer
+ * points to it.
+ */
+static void mm_session_detach(struct mm_session *session,
+			      struct mm_game *game)
+{
+	spin_lock(&game->lock);
+	list_del(&session->game_link);
+	mm_game_update_reclaimable(game);
+	if (game->is_private)
+		mm_game_quit(game);
+	spin_unlock(&game->lock);
+}
+
+/**
+ * mm_room_free_games() - drop the table's reference to every game of a room
+ * @room: room whose games to free
+ *
+ * Games nobody else holds are freed after an RCU grace period.
+ */
+static void mm_room_free_games(struct mm_room *room)
+{
+	struct hlist_node *tmp;
+	struct mm_game *cont;
+	int bkt;
+
+	hash_for_each_safe(room->games, bkt, tmp, cont, node) {
+		hash_del_rcu(&cont->node);
+		room->table_count--;
+		if (cont->reclaimable)
+			atomic_long_dec(&room->reclaimable);
+		mm_game_put(cont);
+	}
+}
+
+/**
+ * mm_free_games() - frees all game memory of every room
+ *
+ * Must only be called once no reader can reach the rooms anymore,
+ * i.e. after both devices and the interrupt handler are gone. Private
+ * games are already gone by then, since each was freed when its file
+ * was closed.
+ *
+ * return void
+ */
+static void mm_free_games(void)
+{
+	unsigned i;
+
+	for (i = 0; i < mm_nr_rooms; i++)
+		mm_room_free_games(&mm_rooms[i]);
+	/* wait for every mm_game_free_rcu() to finish */
+	rcu_barrier();
+}
+
+/**
+ * mm_open() - callback invoked when a process opens /dev/mm
+ * @inode: inode of the device (ignored)
+ * @filp: process's file object. misc_open() left the room's device in
+ * private_data; it gets the session instead.
+ *
+ * Attach a session playing the caller's uid game in that room to @filp.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_open(struct inode *inode, struct file *filp)
+{
+	struct mm_room *room = container_of(filp->private_data,
+					    struct mm_room, dev);
+	struct mm_session *session;
+	struct mm_game *game;
+
+	mm_stat_inc(room, ops[MM_OP_OPEN]);
+	session = kzalloc(sizeof(*session), GFP_KERNEL);
+	if (!session)
+		return -ENOMEM;
+	mutex_init(&session->lock);
+	init_waitqueue_head(&session->wq);
+	session->room = room;
+	game = mm_find_game(room, current_uid());
+	if (!game) {
+		kfree(session);
+		return -ENOMEM;
+	}
+	mm_session_attach(session, game);
+	filp->private_data = session;
+	return 0;
+}
+
+/**
+ * mm_release() - callback invoked when the last reference to a /dev/mm
+ * file is closed
+ * @inode: inode of the device (ignored)
+ * @filp: process's file object holding the session
+ *
+ * Return: always 0
+ */
+static int mm_release(struct inode *inode, struct file *filp)
+{
+	struct mm_session *session = filp->private_data;
+	struct mm_game *game = rcu_dereference_protected(session->game, 1);
+
+	mm_session_detach(session, game);
+	mm_game_put(game);
+	kfree(session);
+	return 0;
+}
+
+/**
+ * mm_session_get_game() - get a reference to a session's game
+ * @session: session of the calling file
+ *
+ * Only needed by paths that sleep while using the game. Paths that do
+ * not can use rcu_dereference(session->game) under rcu_read_lock().
+ *
+ * Return: the game, or NULL if it is being torn down
+ */
+static struct mm_game *mm_session_get_game(struct mm_session *session)
+{
+	struct mm_game *game;
+
+	rcu_read_lock();
+	game = rcu_dereference(session->game);
+	if (!kref_get_unless_zero(&game->ref))
+		game = NULL;
+	rcu_read_unlock();
+	return game;
+}
+
+/**
+ * mm_read_iter() - callback invoked when a process reads from
+ * /dev/mm
+ * @iocb: I/O control block; its file is the reader's, and ki_pos is
+ * the file offset (in/out parameter)
+ * @to: destination buffers to store output
+ *
+ * Write to @to the result of every guess of the most recent write to
+ * this game, four characters each, in the order they were written.
+ * Before the first guess of a game, that is the single @last_result
+ * "B-W-". Counts of 10 or more, possible in games of more than 9 pegs,
+ * are written as the letters 'a' to 'g' so that each result stays four
+ * characters. Copy at most the size of @to, and only when ki_pos is 0.
+ * Then increment ki_pos by the number of bytes copied.
+ *
+ * The results of the most recent write stay readable after its last
+ * guess wins the game. Otherwise, if no game is active, instead copy up
+ * to four '?' characters.
+ *
+ * Return: number of bytes written to @to, or negative on error
+ */
+static ssize_t mm_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct mm_session *session = iocb->ki_filp->private_data;
+	size_t num_bytes = iov_iter_count(to);
+	char result[MM_MAX_BATCH * 4];
+	size_t len;
+	unsigned i;
+	u16 score;
+	u64 locked;
+	struct mm_game *game_vars;
+
+	mm_stat_inc(session->room, ops[MM_OP_READ]);
+	if (iocb->ki_pos > 0)
+		return 0;
+
+	/*snapshot the results so no lock is held across the copy */
+	rcu_read_lock();
+	game_vars = rcu_dereference(session->game);
+	locked = mm_game_lock(game_vars);
+	if (game_vars->batch_len != 0) {
+		for (i = 0; i < game_vars->batch_len; i++) {
+			score = game_vars->batch_scores[i];
+			result[i * 4] = 'B';
+			result[i * 4 + 1] = mm_count_char(MM_SCORE_BLACK(score));
+			result[i * 4 + 2] = 'W';
+			result[i * 4 + 3] = mm_count_char(MM_SCORE_WHITE(score));
+		}
+		len = i * 4;
+	} else if (!game_vars->game_active) {
+		memcpy(result, "????", 4);
+		len = 4;
+	} else {
+		memcpy(result, game_vars->last_result, 4);
+		len = 4;
+	}
+	WRITE_ONCE(session->seen_result_seq, game_vars->result_seq);
+	WRITE_ONCE(session->seen_code_gen,
+		   READ_ONCE(session->room->code_gen));
+	mm_game_unlock(game_vars, locked);
+	rcu_read_unlock();
+
+	if (num_bytes > len)
+		num_bytes = len;
+	if (copy_to_iter(result, num_bytes, to) != num_bytes)
+		return -EFAULT;
+	iocb->ki_pos += num_bytes;
+	return num_bytes;
+}
+
+/* longest batch mm_write_iter() takes in: each guess plus a separator */
+#define MM_BATCH_BYTES (MM_MAX_BATCH * (MM_MAX_PEGS + 1))
+
+/**
+ * mm_write_iter() - callback invoked when a process writes to /dev/mm
+ * @iocb: I/O control block; its file is the writer's
+ * @from: source buffers from user, from write() or writev()
+ *
+ * If the user is not currently playing a game, then return -EINVAL.
+ *
+ * Interpret the input as a batch of up to MM_MAX_BATCH guesses, each
+ * one hexadecimal digit per peg of the game, below the game's number
+ * of colors. Guesses may be separated by whitespace, and a
+ * NUL byte ends the batch. For every guess, calculate how many are in
+ * the correct value and position, and how many are simply the correct
+ * value. Then update @num_guesses, @last_result, and @user_view, and
+ * remember the score for mm_read_iter(). The whole batch is scored
+ * under a single acquisition of the game's lock.
+ *
+ * If an entry is not a valid guess, the guesses before it are still
+ * scored, and the return value is the offset of the rejected entry in
+ * the input. Likewise, when a guess wins the game and more guesses
+ * follow it, the return value is the offset just past it. Writing the
+ * rest again then fails with -EINVAL. A winning last guess consumes the
+ * whitespace or NUL after it, so "echo 4211 > /dev/mm" is one full
+ * write. Input beyond MM_MAX_BATCH guesses is left unconsumed, as
+ * with any short write.
+ *
+ * <em>Caution: the input is NOT a string; it is not necessarily
+ * null-terminated.</em> You CANNOT use strcpy() or strlen() on it!
+ *
+ * Return: number of bytes consumed, or negative on error
+ */
+static ssize_t mm_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct mm_session *session = iocb->ki_filp->private_data;
+	size_t count = iov_iter_count(from);
+	char buf[MM_BATCH_BYTES];
+	u64 guesses[MM_MAX_BATCH];
+	u16 ends[MM_MAX_BATCH];
+	size_t len;
+	size_t pos = 0;
+	size_t consumed;
+	unsigned n = 0;
+	unsigned k;
+	size_t i;
+	unsigned pegs;
+	unsigned colors;
+	int digit;
+	bool rejected = false;
+	u16 score;
+	u64 start = ktime_get_ns();
+	u64 locked;
+	struct mm_game *game_vars;
+
+	mm_stat_inc(session->room, ops[MM_OP_WRITE]);
+	if (count == 0)
+		return -EINVAL;
+
+	len = min(count, sizeof(buf));
+	if (copy_from_iter(buf, len, from) != len)
+		return -EFAULT;
+
+	/*
+	 * parse and validate the whole batch before taking the lock,
+	 * against the shape the game has now
+	 */
+	rcu_read_lock();
+	game_vars = rcu_dereference(session->game);
+	pegs = READ_ONCE(game_vars->pegs);
+	colors = READ_ONCE(game_vars->colors);
+	if (pegs == 0) {
+		/*never started */
+		rcu_read_unlock();
+		return -EINVAL;
+	}
+	consumed = 0;
+	while (pos < len && n < MM_MAX_BATCH && !rejected) {
+		if (buf[pos] == '\0') {
+			/*as before, ignore everything after a C string */
+			pos = count;
+			break;
+		}
+		if (isspace(buf[pos])) {
+			pos++;
+			continue;
+		}
+		consumed = pos;
+		if (len - pos < pegs) {
+			/*a guess cut short by the end of buf comes next time */
+			rejected = (len == count);
+			break;
+		}
+		guesses[n] = 0;
+		for (i = 0; i < pegs; i++) {
+			digit = hex_to_bin(buf[pos + i]);
+			if (digit < 0 || digit >= colors) {
+				rejected = true;
+				break;
+			}
+			guesses[n] = guesses[n] << 4 | digit;
+		}
+		if (rejected)
+			break;
+		pos += pegs;
+		ends[n++] = pos;
+	}
+	if (!rejected)
+		consumed = min(pos, count);
+	if (n == 0) {
+		rcu_read_unlock();
+		return -EINVAL;
+	}
+
+	locked = mm_game_lock(game_vars);
+	/*a restart may have changed the shape since the batch was parsed */
+	if (!game_vars->game_active || game_vars->pegs != pegs ||
+	    game_vars->colors != colors) {
+		mm_game_unlock(game_vars, locked);
+		rcu_read_unlock();
+		return -EINVAL;
+	}
+	for (k = 0; k < n; k++) {
+		score = mm_game_guess(game_vars, guesses[k]);
+		game_vars->batch_scores[k] = score;
+		if (!game_vars->game_active) {
+			/*
+			 * the game was won, leave the rest of the batch; if
+			 * all that follows is whitespace, consume it as before
+			 */
+			if (k + 1 < n || rejected)
+				consumed = ends[k];
+			k++;
+			break;
+		}
+	}
+	game_vars->batch_len = k;
+	mm_game_notify(game_vars, POLLIN);
+	mm_game_unlock(game_vars, locked);
+	rcu_read_unlock();
+	mm_stat_guesses(session->room, k, ktime_get_ns() - start);
+	return consumed;
+}
+
+/**
+ * mm_poll() - callback invoked when a process polls /dev/mm
+ * @filp: process's file object holding the session
+ * @wait: poll table to register the session's wait queue with
+ *
+ * The file is readable (POLLIN) once a result was scored, or its game
+ * started or ended, since the file was last read. It has urgent data
+ * (POLLPRI) once the target code changed over CS421Net since then.
+ * Reading it, or MM_IOC_GET_STATE, clears both. It is writable
+ * (POLLOUT) while its game is active.
+ *
+ * Return: mask of the events that are ready
+ */
+static unsigned int mm_poll(struct file *filp, poll_table * wait)
+{
+	struct mm_session *session = filp->private_data;
+	struct mm_game *game;
+	unsigned int mask = 0;
+	u64 locked;
+
+	mm_stat_inc(session->room, ops[MM_OP_POLL]);
+	poll_wait(filp, &session->wq, wait);
+	poll_wait(filp, &session->room->code_wq, wait);
+
+	rcu_read_lock();
+	game = rcu_dereference(session->game);
+	locked = mm_game_lock(game);
+	if (game->result_seq != READ_ONCE(session->seen_result_seq))
+		mask |= POLLIN | POLLRDNORM;
+	if (READ_ONCE(session->room->code_gen) !=
+	    READ_ONCE(session->seen_code_gen))
+		mask |= POLLPRI;
+	if (game->game_active)
+		mask |= POLLOUT | POLLWRNORM;
+	mm_game_unlock(game, locked);
+	rcu_read_unlock();
+	return mask;
+}
+
+/**
+ * mm_view_vm_open() - count another mapping of a game's view
+ * @vma: the new mapping, whose vm_private_data is the game
+ *
+ * Called when a mapping is copied by fork(). Each mapping holds a
+ * reference to its game.
+ */
+static void mm_view_vm_open(struct vm_area_struct *vma)
+{
+	struct mm_game *game = vma->vm_private_data;
+
+	kref_get(&game->ref);
+	spin_lock(&game->lock);
+	game->view_maps++;
+	mm_game_update_reclaimable(game);
+	spin_unlock(&game->lock);
+}
+
+/**
+ * mm_view_vm_close() - stop rendering a game's view once nobody maps it
+ * @vma: the mapping going away, whose vm_private_data is the game
+ */
+static void mm_view_vm_close(struct vm_area_struct *vma)
+{
+	struct mm_game *game = vma->vm_private_data;
+
+	spin_lock(&game->lock);
+	game->view_maps--;
+	mm_game_update_reclaimable(game);
+	spin_unlock(&game->lock);
+	mm_game_put(game);
+}
+
+static const struct vm_operations_struct mm_view_vm_ops = {
+	.open = mm_view_vm_open,
+	.close = mm_view_vm_close,
+};
+
+/**
+ * mm_mmap() - callback invoked when a process mmap()s to /dev/mm
+ * @filp: process's file object that is mapping to this device
+ * @vma: virtual memory allocation object containing mmap() request
+ *
+ * Create a read-only mapping from kernel memory into user space. The
+ * offset selects what is mapped:
+ *  - MM_MMAP_VIEW_PGOFF: @user_view, at most one page. It is rendered
+ *    from @history here, and kept current for as long as it is mapped.
+ *  - MM_MMAP_RING_PGOFF: the history ring, a struct mm_ring_header page
+ *    followed by MM_RING_PAGES data pages, or a prefix of them
+ *  - MM_MMAP_STATE_PGOFF: the game's struct mm_shared_state, one page
+ *
+ * Pages are inserted with their reference counts raised, so a mapping
+ * stays valid even after its game is freed.
+ *
+ * Code based upon
+ * <a href="http://bloggar.combitech.se/ldc/2015/01/21/mmap-memory-between-kernel-and-userspace/">http://bloggar.combitech.se/ldc/2015/01/21/mmap-memory-between-kernel-and-userspace/</a>
+ *
+ * Return: 0 on success, negative on error.
+ */
+static int mm_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct mm_session *session = filp->private_data;
+	unsigned long size = (unsigned long)(vma->vm_end - vma->vm_start);
+	unsigned long pgoff = vma->vm_pgoff;
+	struct mm_game *game_vars;
+	struct mm_ring_header *ring = NULL;
+	char *view = NULL;
+	struct mm_shared_state *shared = NULL;
+	int err;
+
+	mm_stat_inc(session->room, ops[MM_OP_MMAP]);
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (pgoff == MM_MMAP_VIEW_PGOFF || pgoff == MM_MMAP_STATE_PGOFF) {
+		if (size > PAGE_SIZE)
+			return -EIO;
+	} else if (pgoff >= MM_MMAP_RING_PGOFF &&
+		   pgoff - MM_MMAP_RING_PGOFF <= MM_RING_PAGES) {
+		pgoff -= MM_MMAP_RING_PGOFF;
+		if (size > PAGE_SIZE + MM_RING_SIZE - (pgoff << PAGE_SHIFT))
+			return -EIO;
+	} else
+		return -EINVAL;
+
+	game_vars = mm_session_get_game(session);
+	if (game_vars == 0)
+		return -ENOMEM;
+
+	/*none of the regions move once they are allocated */
+	if (vma->vm_pgoff == MM_MMAP_VIEW_PGOFF)
+		view = mm_game_view(game_vars);
+	else if (vma->vm_pgoff == MM_MMAP_STATE_PGOFF)
+		shared = mm_game_shared(game_vars);
+	else
+		ring = mm_game_ring(game_vars);
+	if (!view)
+		mm_game_put(game_vars);
+	if (!view && !ring && !shared)
+		return -ENOMEM;
+
+	/*vm_flags can only be changed through helpers since 6.3 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	vma->vm_page_prot = PAGE_READONLY;
+	if (view) {
+		err = vm_insert_page(vma, vma->vm_start, virt_to_page(view));
+		if (err) {
+			mm_game_put(game_vars);
+			return -EAGAIN;
+		}
+		/*the mapping keeps the game reference taken above */
+		vma->vm_private_data = game_vars;
+		vma->vm_ops = &mm_view_vm_ops;
+		spin_lock(&game_vars->lock);
+		if (game_vars->view_maps++ == 0)
+			mm_game_render(game_vars);
+		mm_game_update_reclaimable(game_vars);
+		spin_unlock(&game_vars->lock);
+		return 0;
+	}
+	if (shared)
+		err = vm_insert_page(vma, vma->vm_start, virt_to_page(shared));
+	else
+		err = remap_vmalloc_range(vma, ring, pgoff);
+	if (err)
+		return -EAGAIN;
+	return 0;
+}
+
+/**
+ * mm_game_guess_one() - score a guess made outside of write()
+ * @game: active game, whose lock must be held
+ * @guess: the guess, @game's pegs packed like its target
+ *
+ * The guess counts as a batch of one, so a read() afterwards returns
+ * its result, and pollers are woken up.
+ *
+ * Return: the guess's score, packed with MM_SCORE()
+ */
+static u16 mm_game_guess_one(struct mm_game *game, u64 guess)
+{
+	u16 score = mm_game_guess(game, guess);
+
+	game->batch_scores[0] = score;
+	game->batch_len = 1;
+	mm_game_notify(game, POLLIN);
+	return score;
+}
+
+/**
+ * mm_ioctl_private() - handle MM_IOC_PRIVATE
+ * @session: session of the calling file
+ *
+ * Detach the session from the caller's uid game, and give it a newly
+ * started game of its own in the same room instead. That game is only reachable through
+ * the session's file, and ends once the file is closed. Issuing it
+ * again throws the private game away and starts another one.
+ *
+ * Return: 0 on success, negative on error
+ */
+static long mm_ioctl_private(struct mm_session *session)
+{
+	struct mm_room *room = session->room;
+	struct mm_game *game;
+	struct mm_game *old;
+
+	game = mm_game_alloc(room, current_uid());
+	if (!game)
+		return -ENOMEM;
+	game->is_private = true;
+
+	spin_lock(&game->lock);
+	mm_game_start(game, NUM_PEGS, READ_ONCE(room->max_numbers));
+	spin_unlock(&game->lock);
+
+	/*the session's reference moves from the old game to the new */
+	mutex_lock(&session->lock);
+	old = rcu_dereference_protected(session->game,
+					lockdep_is_held(&session->lock));
+	mm_session_detach(session, old);
+	mm_session_attach(session, game);
+	mutex_unlock(&session->lock);
+	mm_game_put(old);
+	return 0;
+}
+
+/**
+ * mm_session_start() - start or restart a session's game
+ * @session: session of the calling file
+ * @arg: shape of the new game, already copied from the caller
+ *
+ * Return: 0 on success, negative on error
+ */
+static long mm_session_start(struct mm_session *session,
+			     const struct mm_ioc_start *arg)
+{
+	struct mm_game *game;
+	unsigned pegs;
+	unsigned colors;
+
+	pegs = arg->pegs ? arg->pegs : NUM_PEGS;
+	colors = arg->colors ? arg->colors :
+	    READ_ONCE(session->room->max_numbers);
+	if (pegs == 0 || pegs > MM_MAX_PEGS || colors < 2 ||
+	    colors > MM_MAX_COLORS || arg->flags != 0 || arg->reserved != 0)
+		return -EINVAL;
+
+	game = mm_session_get_game(session);
+	if (!game)
+		return -ENOENT;
+	spin_lock(&game->lock);
+	mm_game_start(game, pegs, colors);
+	mm_game_notify(game, POLLIN | POLLOUT);
+	spin_unlock(&game->lock);
+	mm_game_put(game);
+	return 0;
+}
+
+/**
+ * mm_ioctl_start() - handle MM_IOC_START
+ * @session: session of the calling file
+ * @uarg: user's struct mm_ioc_start
+ *
+ * Return: 0 on success, negative on error
+ */
+static long mm_ioctl_start(struct mm_session *session,
+			   struct mm_ioc_start __user * uarg)
+{
+	struct mm_ioc_start arg;
+
+	if (copy_from_user(&arg, uarg, sizeof(arg)) != 0)
+		return -EFAULT;
+	return mm_session_start(session, &arg);
+}
+
+/**
+ * mm_ioctl_guess() - handle MM_IOC_GUESS
+ * @session: session of the calling file
+ * @uarg: user's struct mm_ioc_guess, which receives the score
+ *
+ * Return: 0 on success, negative on error
+ */
+static long mm_ioctl_guess(struct mm_session *session,
+			   struct mm_ioc_guess __user * uarg)
+{
+	struct mm_ioc_guess arg;
+	struct mm_game *game;
+	u64 guess = 0;
+	size_t i;
+	u16 score;
+	u64 start = ktime_get_ns();
+	u64 locked;
+
+	if (copy_from_user(&arg, uarg, sizeof(arg)) != 0)
+		return -EFAULT;
+	if (arg.reserved != 0)
+		return -EINVAL;
+
+	rcu_read_lock();
+	game = rcu_dereference(session->game);
+	locked = mm_game_lock(game);
+	for (i = 0; i < MM_IOC_MAX_PEGS; i++) {
+		if (i >= game->pegs ? arg.pegs[i] != 0 :
+		    arg.pegs[i] >= game->colors)
+			break;
+		guess = guess << 4 | arg.pegs[i];
+	}
+	if (!game->game_active || i < MM_IOC_MAX_PEGS) {
+		mm_game_unlock(game, locked);
+		rcu_read_unlock();
+		return -EINVAL;
+	}
+	/*the unused pegs shifted in zeros after the code */
+	guess >>= 4 * (MM_MAX_PEGS - game->pegs);
+	score = mm_game_guess_one(game, guess);
+	arg.num_guesses = game->num_guesses;
+	arg.active = game->game_active;
+	mm_game_unlock(game, locked);
+	rcu_read_unlock();
+	mm_stat_guesses(session->room, 1, ktime_get_ns() - start);
+
+	arg.black = MM_SCORE_BLACK(score);
+	arg.white = MM_SCORE_WHITE(score);
+	if (copy_to_user(uarg, &arg, sizeof(arg)) != 0)
+		return -EFAULT;
+	return 0;
+}
+
+/**
+ * mm_ioctl_get_state() - handle MM_IOC_GET_STATE
+ * @session: session of the calling file
+ * @uarg: user's struct mm_ioc_state, which receives the state
+ *
+ * Return: 0 on success, negative on error
+ */
+static long mm_ioctl_get_state(struct mm_session *session,
+			       struct mm_ioc_state __user * uarg)
+{
+	struct mm_ioc_state arg;
+	struct mm_game *game;
+	u64 locked;
+
+	memset(&arg, 0, sizeof(arg));
+	rcu_read_lock();
+	game = rcu_dereference(session->game);
+	locked = mm_game_lock(game);
+	arg.num_guesses = game->num_guesses;
+	arg.active = game->game_active;
+	if (game->num_guesses == 0) {
+		arg.black = MM_IOC_NO_SCORE;
+		arg.white = MM_IOC_NO_SCORE;
+	} else {
+		arg.black = MM_SCORE_BLACK(game->last_score);
+		arg.white = MM_SCORE_WHITE(game->last_score);
+	}
+	arg.pegs = game->pegs;
+	arg.colors = game->colors;
+	WRITE_ONCE(session->seen_result_seq, game->result_seq);
+	WRITE_ONCE(session->seen_code_gen,
+		   READ_ONCE(session->room->code_gen));
+	mm_game_unlock(game, locked);
+	rcu_read_unlock();
+
+	if (copy_to_user(uarg, &arg, sizeof(arg)) != 0)
+		return -EFAULT;
+	return 0;
+}
+
+/**
+ * mm_ioctl() - callback invoked when a process calls ioctl() on
+ * /dev/mm
+ * @filp: process's file object holding the session
+ * @cmd: request code, one of the MM_IOC_* values in mastermind2.h
+ * @arg: user pointer to the request's structure, if it has one
+ *
+ * This is the binary counterpart of writing to /dev/mm and /dev/mm_ctl.
+ * Every request acts on the game of @filp, which is the caller's uid
+ * game unless MM_IOC_PRIVATE was issued on @filp.
+ *
+ * Return: 0 on success, negative on error
+ */
+static long mm_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct mm_session *session = filp->private_data;
+	void __user *uarg = (void __user *)arg;
+	struct mm_game *game;
+
+	mm_stat_inc(session->room, ops[MM_OP_IOCTL]);
+	switch (cmd) {
+	case MM_IOC_PRIVATE:
+		return mm_ioctl_private(session);
+	case MM_IOC_VERSION:
+		return put_user(MM_ABI_VERSION, (__u32 __user *) uarg);
+	case MM_IOC_START:
+		return mm_ioctl_start(session, uarg);
+	case MM_IOC_QUIT:
+		rcu_read_lock();
+		game = rcu_dereference(session->game);
+		spin_lock(&game->lock);
+		mm_game_quit(game);
+		mm_game_notify(game, POLLIN);
+		spin_unlock(&game->lock);
+		rcu_read_unlock();
+		return 0;
+	case MM_IOC_GUESS:
+		return mm_ioctl_guess(session, uarg);
+	case MM_IOC_GET_STATE:
+		return mm_ioctl_get_state(session, uarg);
+	default:
+		return -ENOTTY;
 	}
 }
 
+#ifdef MM_HAVE_URING_CMD
 /**
- * mm_write() - callback invoked when a process writes to /dev/mm
- * @filp: process's file object that is reading from this device (ignored)
- * @ubuf: source buffer from user
- * @count: number of bytes in @ubuf
- * @ppos: file offset (ignored)
+ * mm_session_guess() - score one packed guess in a session's game
+ * @session: session of the calling file
+ * @guess: the guess, packed like the game's target
+ * @active: *OUT* parameter, whether the game is still going
  *
- * If the user is not currently playing a game, then return -EINVAL.
+ * Like MM_IOC_GUESS, see mm_game_guess_one().
  *
- * If @count is less than NUM_PEGS, then return -EINVAL. Otherwise,
- * interpret the first NUM_PEGS characters in @ubuf as the user's
- * guess. Calculate how many are in the correct value and position,
- * and how many are simply the correct value. Then update
- * @num_guesses, @last_result, and @user_view.
+ * Return: the score packed with MM_SCORE(), or -EINVAL if no game is
+ * active or @guess is not a code of the game's shape
+ */
+static int mm_session_guess(struct mm_session *session, u64 guess,
+			    bool *active)
+{
+	struct mm_game *game;
+	u64 start = ktime_get_ns();
+	u64 locked;
+	u16 score;
+	unsigned i;
+
+	rcu_read_lock();
+	game = rcu_dereference(session->game);
+	locked = mm_game_lock(game);
+	if (game->pegs < MM_MAX_PEGS && guess >> (4 * game->pegs) != 0)
+		goto invalid;
+	for (i = 0; i < game->pegs; i++)
+		if (((guess >> (4 * i)) & 0xf) >= game->colors)
+			goto invalid;
+	if (!game->game_active)
+		goto invalid;
+
+	score = mm_game_guess_one(game, guess);
+	*active = game->game_active;
+	mm_game_unlock(game, locked);
+	rcu_read_unlock();
+	mm_stat_guesses(session->room, 1, ktime_get_ns() - start);
+	return score;
+
+invalid:
+	mm_game_unlock(game, locked);
+	rcu_read_unlock();
+	return -EINVAL;
+}
+
+/**
+ * mm_uring_cmd_arg() - find a command's structure in its SQE
+ * @ioucmd: the command
  *
- * <em>Caution: @ubuf is NOT a string; it is not necessarily
- * null-terminated.</em> You CANNOT use strcpy() or strlen() on it!
+ * Up to 6.4, struct io_uring_cmd points at the SQE's cmd area itself;
+ * from 6.5 on it points at the whole SQE instead.
  *
- * Return: @count, or negative on error
+ * Return: the cmd area of the command's SQE
  */
-static ssize_t mm_write(struct file *filp, const char __user * ubuf,
-			size_t count, loff_t * ppos)
+static const void *mm_uring_cmd_arg(const struct io_uring_cmd *ioucmd)
 {
-	unsigned long flags;
-	size_t i;
-	int g[NUM_PEGS];
-	char guess[NUM_PEGS];
-	unsigned black;
-	unsigned white;
-	struct mm_game *game_vars;
-
-	spin_lock_irqsave(&mm_spinlock, flags);
-	game_vars = mm_find_game(current_uid());
-	spin_unlock_irqrestore(&mm_spinlock, flags);
-
-	if (game_vars == 0)
-		return -ENOMEM;
-
-	spin_lock_irqsave(&mm_spinlock, flags);
-	if (game_vars->game_active && count >= NUM_PEGS) {
-		spin_unlock_irqrestore(&mm_spinlock, flags);
-		if (copy_from_user(guess, ubuf, NUM_PEGS) != 0)
-			return -1;
-		spin_lock_irqsave(&mm_spinlock, flags);
-		for (i = 0; i < NUM_PEGS; i++) {
-			g[i] = guess[i] - '0';
-			if (g[i] > max_numbers)
-				return -EINVAL;
-		}
-
-		/*get number of black and white pegs */
-		mm_num_pegs(game_vars->target_code, g, &black, &white);
-
-		/*update last result */
-		game_vars->last_result[1] = black + '0';
-		game_vars->last_result[3] = white + '0';
-
-		/*updates num guesses */
-		game_vars->num_guesses++;
-
-		/*update user_view */
-		game_vars->uv_off +=
-		    scnprintf(game_vars->user_view + game_vars->uv_off,
-			      PAGE_SIZE, "Guess %d: %d%d%d%d | %c%c%c%c\n",
-			      game_vars->num_guesses, g[0], g[1], g[2], g[3],
-			      game_vars->last_result[0],
-			      game_vars->last_result[1],
-			      game_vars->last_result[2],
-			      game_vars->last_result[3]);
-		pr_info("%s\n", game_vars->user_view);
-
-		if (black == NUM_PEGS) {
-			game_vars->uv_off +=
-			    scnprintf(game_vars->user_view +
-				      game_vars->uv_off, PAGE_SIZE,
-				      "You won the game!\n");
-			game_vars->game_active = false;
-		}
-		spin_unlock_irqrestore(&mm_spinlock, flags);
-		return count;
-	} else {
-		spin_unlock_irqrestore(&mm_spinlock, flags);
-		return -EINVAL;
-	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	return io_uring_sqe_cmd(ioucmd->sqe);
+#else
+	return ioucmd->cmd;
+#endif
 }
 
 /**
- * mm_mmap() - callback invoked when a process mmap()s to /dev/mm
- * @filp: process's file object that is mapping to this device (ignored)
- * @vma: virtual memory allocation object containing mmap() request
- *
- * Create a read-only mapping from kernel memory (specifically,
- * @user_view) into user space.
+ * mm_uring_cmd() - callback invoked for an IORING_OP_URING_CMD on
+ * /dev/mm
+ * @ioucmd: the command; cmd_op is one of the MM_URING_* values in
+ * mastermind2.h, and cmd points to its structure in the SQE
+ * @issue_flags: how io_uring issued the command (ignored)
  *
- * Code based upon
- * <a href="http://bloggar.combitech.se/ldc/2015/01/21/mmap-memory-between-kernel-and-userspace/">http://bloggar.combitech.se/ldc/2015/01/21/mmap-memory-between-kernel-and-userspace/</a>
+ * Lets a client keep many games in flight with one io_uring_enter()
+ * per round instead of a write() and a read() per game. Commands act on
+ * the game of the file, like mm_ioctl(). Nothing here sleeps, so every
+ * command completes inline, even when issued non-blocking, and its
+ * CQE res is the return value.
  *
- * You do not need to modify this function.
+ * The SQE stays writable by user space while the command runs, so each
+ * command's structure is copied out of it before being looked at.
  *
- * Return: 0 on success, negative on error.
+ * Return: for MM_URING_GUESS, the score packed with MM_SCORE(), with
+ * MM_URING_ACTIVE set unless the guess won; for MM_URING_START, 0; or
+ * negative on error
  */
-static int mm_mmap(struct file *filp, struct vm_area_struct *vma)
+static int mm_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
 {
-	unsigned long flags;
-	unsigned long size = (unsigned long)(vma->vm_end - vma->vm_start);
-	unsigned long page;
-	struct mm_game *game_vars;
+	struct mm_session *session = ioucmd->file->private_data;
+	struct mm_ioc_start start;
+	struct mm_uring_guess guess;
+	bool active;
+	int score;
+
+	mm_stat_inc(session->room, ops[MM_OP_URING]);
+	switch (ioucmd->cmd_op) {
+	case MM_URING_START:
+		memcpy(&start, mm_uring_cmd_arg(ioucmd), sizeof(start));
+		return mm_session_start(session, &start);
+	case MM_URING_GUESS:
+		memcpy(&guess, mm_uring_cmd_arg(ioucmd), sizeof(guess));
+		if (guess.reserved != 0)
+			return -EINVAL;
+		score = mm_session_guess(session, guess.code, &active);
+		if (score >= 0 && active)
+			score |= MM_URING_ACTIVE;
+		return score;
+	default:
+		return -ENOTTY;
+	}
+}
+#endif
 
-	spin_lock_irqsave(&mm_spinlock, flags);
-	game_vars = mm_find_game(current_uid());
+/* commands of /dev/mm_ctl, see mm_ctl_write() */
+enum mm_ctl_cmd {
+	MM_CTL_START,
+	MM_CTL_QUIT,
+	MM_CTL_COLORS,
+};
 
-	if (game_vars == 0)
-		return -ENOMEM;
+/**
+ * struct mm_ctl_req - a parsed /dev/mm_ctl command
+ * @cmd: the command
+ * @pegs: for MM_CTL_START, pegs of the new game
+ * @colors: for MM_CTL_START, colors of the new game, or 0 for the
+ * current number; for MM_CTL_COLORS, the new number of colors
+ */
+struct mm_ctl_req {
+	enum mm_ctl_cmd cmd;
+	unsigned pegs;
+	unsigned colors;
+};
 
-	page = vmalloc_to_pfn(game_vars->user_view);
-	spin_unlock_irqrestore(&mm_spinlock, flags);
+/**
+ * mm_ctl_parse() - parse a command written to /dev/mm_ctl
+ * @input: the command, with a null byte after its @count bytes
+ * @count: bytes in @input, at most 16
+ * @req: *OUT* parameter, receives the command
+ *
+ * See mm_ctl_write() for the commands. Kept apart from it so the
+ * grammar can be tested without a user buffer.
+ *
+ * Return: 0 on success, -EINVAL if @input is not a command
+ */
+static int mm_ctl_parse(const char *input, size_t count,
+			struct mm_ctl_req *req)
+{
+	const char *go = "start";
+	const char *stop = "quit";
+	const char *colors = "colors X";
+	size_t i;
+	int num = 0;
+	int end = 0;
 
-	if (size > PAGE_SIZE) {
-		return -EIO;
-	}
-	vma->vm_pgoff = 0;
-	vma->vm_page_prot = PAGE_READONLY;
-	if (remap_pfn_range(vma, vma->vm_start, page, size, vma->vm_page_prot)) {
+	req->pegs = NUM_PEGS;
+	req->colors = 0;
 
-		return -EAGAIN;
-	}
+	/*check to see if input is valid and whether it was start or quit */
+	if (count > 0 && go[0] == input[0]) {	/*if start */
+		for (i = 1; i < count && i < 5; i++)
+			if (go[i] != input[i])
+				return -EINVAL;
+		/*"start P C" also picks the shape of the game */
+		if (count > 5 && input[5] != '\0' &&
+		    (input[5] != ' ' ||
+		     sscanf(input + 5, "%u %u %n", &req->pegs, &req->colors,
+			    &end) != 2 || 5 + end != count || req->pegs < 1 ||
+		     req->pegs > MM_MAX_PEGS || req->colors < 2 ||
+		     req->colors > MM_MAX_COLORS))
+			return -EINVAL;
+		req->cmd = MM_CTL_START;
+	} else if (count > 0 && stop[0] == input[0]) {
+		for (i = 1; i < count && i < 5; i++)
+			if (stop[i] != input[i])
+				return -EINVAL;
+		req->cmd = MM_CTL_QUIT;
+	} else if (count > 0 && colors[0] == input[0]) {
+		/*"colors N", where everything from the 8th character on is N */
+		if (count < 8 || strncmp(input, colors, 7) != 0 ||
+		    kstrtoint(input + 7, 10, &num) != 0 || num < 2 ||
+		    num > MM_MAX_COLORS)
+			return -EINVAL;
+		req->cmd = MM_CTL_COLORS;
+		req->colors = num;
+	} else
+		return -EINVAL;
 	return 0;
 }
 
 /**
  * mm_ctl_write() - callback invoked when a process writes to
  * /dev/mm_ctl
- * @filp: process's file object that is writing to this device (ignored)
+ * @filp: process's file object that is writing to this device; its
+ * private_data is the room's ctl_dev
  * @ubuf: source buffer from user
  * @count: number of bytes in @ubuf
  * @ppos: file offset (ignored)
  *
- * Copy the contents of @ubuf, up to the lesser of @count and 8 bytes,
- * to a temporary location. Then parse that character array as
- * following:
+ * Copy the contents of @ubuf, up to the lesser of @count and 16 bytes,
+ * to a temporary location. Then parse that character array with
+ * mm_ctl_parse() as following:
  *
  *  start - Start a new game. If a game was already in progress, restart it.
+ *  start P C - Likewise, but the code has P pegs (1 to 16) of C colors
+ *          (2 to 16) instead of 4 pegs of the current number of colors.
  *  quit  - Quit the current game. If no game was in progress, do nothing.
+ *  colors N - Set the number of colors of new games in the room to N
+ *          (2 to 16). Requires CAP_SYS_ADMIN.
  *
  * If the input is neither of the above, then return -EINVAL.
  *
+ * Only the caller's uid game in the room of this /dev/mm_ctl is
+ * affected; games attached to a single
+ * file with MM_IOC_PRIVATE are not.
+ *
  * <em>Caution: @ubuf is NOT a string;</em> it is not necessarily
  * null-terminated, nor does it necessarily have a trailing
  * newline. You CANNOT use strcpy() or strlen() on it!
@@ -472,112 +2404,106 @@ static int mm_mmap(struct file *filp, struct vm_area_struct *vma)
 static ssize_t mm_ctl_write(struct file *filp, const char __user * ubuf,
 			    size_t count, loff_t * ppos)
 {
-	unsigned long flags;
-	const size_t max = 10;
-	char input[10];
-	const char *go = "start";
-	const char *stop = "quit";
-	const char *colors = "colors X";
-	size_t i;
-	bool valid = true;
-	bool start;
-	int num = 0;
+	const size_t max = 16;
+	char input[17];
+	struct mm_room *room = container_of(filp->private_data,
+					    struct mm_room, ctl_dev);
+	struct mm_ctl_req req;
 	struct mm_game *game_vars;
 
-	spin_lock_irqsave(&mm_spinlock, flags);
-	game_vars = mm_find_game(current_uid());
-	spin_unlock_irqrestore(&mm_spinlock, flags);
-
-	if (game_vars == 0)
-		return -ENOMEM;
+	mm_stat_inc(room, ops[MM_OP_CTL]);
 
 	/*copies user buffer to temp buffer inorder to parse */
 	if (count > max)
 		count = max;
 	if (copy_from_user(input, ubuf, count) != 0)
 		return -1;
+	input[count] = '\0';
 
-	/*check to see if input is valid and whether it was start or quit */
-	if (count > 0 && go[0] == input[0]) {	/*if start */
-		for (i = 1; i < count; i++) {
-			if (go[i] != input[i]) {
-				valid = false;
-				break;
-			}
-		}
-		if (valid)
-			start = true;
-		else
-			return -EINVAL;
-	} else if (count > 0 && stop[0] == input[0]) {
-		for (i = 1; i < count; i++) {
-			if (stop[i] != input[i]) {
-				valid = false;
-				break;
-			}
-		}
-		if (valid)
-			start = false;
-		else
-			return -EINVAL;
-	} else if (count > 0 && colors[0] == input[0]) {
-		for (i = 1; i < count; i++) {
-			if (colors[i] != input[i] || i == 7) {
-				if (i == 7) {
-					num = input[i] - '0';
-					if (num < 2 || num > 9)
-						return -EINVAL;
-				} else {
-					valid = false;
-					break;
-				}
-			}
-		}
-		if (valid) {
-			if (capable(CAP_SYS_ADMIN)) {
-				spin_lock_irqsave(&mm_spinlock, flags);
-				max_numbers = num;
-				spin_unlock_irqrestore(&mm_spinlock, flags);
-				return count;
-			} else
-				return -EACCES;
-		} else
-			return -EINVAL;
-	} else
+	if (mm_ctl_parse(input, count, &req) != 0)
 		return -EINVAL;
+	if (req.cmd == MM_CTL_COLORS) {
+		if (!capable(CAP_SYS_ADMIN))
+			return -EACCES;
+		WRITE_ONCE(room->max_numbers, req.colors);
+		return count;
+	}
 
-	/*if the input was start */
-	spin_lock_irqsave(&mm_spinlock, flags);
-	if (start) {
-
-		game_count++;
-
-		game_vars->target_code[0] = 4;
-		game_vars->target_code[1] = 2;
-		game_vars->target_code[2] = 1;
-		game_vars->target_code[3] = 1;
-
-		game_vars->num_guesses = 0;
-		for (i = 0; i < USER_VIEW_SIZE; i++)
-			game_vars->user_view[i] = '\0';
-		game_vars->game_active = true;
-		game_vars->last_result[0] = 'B';
-		game_vars->last_result[1] = '-';
-		game_vars->last_result[2] = 'W';
-		game_vars->last_result[3] = '-';
-
-		/*reset userview byte offset */
-		game_vars->uv_off = 0;
+	game_vars = mm_find_game(room, current_uid());
+	if (game_vars == 0)
+		return -ENOMEM;
 
+	spin_lock(&game_vars->lock);
+	if (req.cmd == MM_CTL_START) {	/*if the input was start */
+		mm_game_start(game_vars, req.pegs,
+			      req.colors ? req.colors :
+			      READ_ONCE(room->max_numbers));
+		mm_game_notify(game_vars, POLLIN | POLLOUT);
 	} else {		/*if the input was quit */
-		game_vars->game_active = false;
-		active_games--;
+		mm_game_quit(game_vars);
+		mm_game_notify(game_vars, POLLIN);
 	}
-	spin_unlock_irqrestore(&mm_spinlock, flags);
+	spin_unlock(&game_vars->lock);
+	mm_game_put(game_vars);
 
 	return count;
 }
 
+/**
+ * mm_stats_sum() - add up the statistics of all CPUs
+ * @room: room whose statistics to add up, or NULL for every room
+ * @sum: *OUT* parameter, receives the totals
+ */
+static void mm_stats_sum(struct mm_room *room, struct mm_stats *sum)
+{
+	struct mm_stats *cpu_stats;
+	unsigned r;
+	int cpu;
+	int i;
+
+	memset(sum, 0, sizeof(*sum));
+	for (r = 0; r < mm_nr_rooms; r++) {
+		if (room && room != &mm_rooms[r])
+			continue;
+		for_each_possible_cpu(cpu) {
+			cpu_stats = per_cpu_ptr(mm_rooms[r].stats, cpu);
+			sum->game_count += cpu_stats->game_count;
+			sum->code_changed += cpu_stats->code_changed;
+			sum->active_games += cpu_stats->active_games;
+			sum->guesses += cpu_stats->guesses;
+			for (i = 0; i < MM_OP_COUNT; i++)
+				sum->ops[i] += cpu_stats->ops[i];
+			for (i = 0; i < MM_LAT_BUCKETS; i++)
+				sum->guess_latency[i] +=
+				    cpu_stats->guess_latency[i];
+			sum->lock_holds += cpu_stats->lock_holds;
+			sum->lock_hold_ns += cpu_stats->lock_hold_ns;
+			sum->reclaimed_idle += cpu_stats->reclaimed_idle;
+			sum->reclaimed_shrinker +=
+			    cpu_stats->reclaimed_shrinker;
+			sum->codes_superseded += cpu_stats->codes_superseded;
+		}
+	}
+}
+
+/**
+ * mm_net_stats_sum() - add up the CS421Net statistics of all CPUs
+ * @sum: *OUT* parameter, receives the totals
+ */
+static void mm_net_stats_sum(struct mm_net_stats *sum)
+{
+	struct mm_net_stats *cpu_stats;
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		cpu_stats = per_cpu_ptr(&mm_net_stats, cpu);
+		sum->invalid_attempts += cpu_stats->invalid_attempts;
+		sum->bursts += cpu_stats->bursts;
+		sum->burst_packets += cpu_stats->burst_packets;
+	}
+}
+
 /**
  * cs421net_top() - top-half of CS421Net ISR
  * @irq: IRQ that was invoked (ignored)
@@ -594,27 +2520,146 @@ static irqreturn_t cs421net_top(int irq, void *cookie)
 	return IRQ_NONE;
 }
 
+/* longest valid CS421Net payload: a room number, a colon and a code */
+#define MM_PACKET_MAX (NUM_PEGS + 3)
+
+/* most packets a single run of cs421net_bottom() drained */
+static unsigned mm_burst_max;
+
+/**
+ * mm_packet_code() - parse a CS421Net payload
+ * @data: the payload, not null-terminated
+ * @len: length of @data
+ * @room: *OUT* parameter, index of the room the code is for, or -1 for
+ * every room
+ * @code: *OUT* parameter, the packed code
+ * @code_colors: *OUT* parameter, colors the code needs
+ *
+ * A payload is either a code for every room, or a room number in
+ * decimal, a colon and a code for that room only ("2:4321"). A code is
+ * exactly NUM_PEGS bytes, each the ASCII representation of a digit from
+ * 2 up to 9. Whether a room has enough colors for the code is left to
+ * the caller.
+ *
+ * Return: true if @data is well-formed and names an existing room
+ */
+static bool mm_packet_code(const char *data, size_t len, int *room,
+			   u64 *code, unsigned *code_colors)
+{
+	int num;
+	int i;
+
+	if (len > MM_PACKET_MAX)
+		return false;
+	*room = -1;
+	if (len > NUM_PEGS) {
+		*room = 0;
+		for (i = 0; i < len - NUM_PEGS - 1; i++) {
+			if (data[i] < '0' || data[i] > '9')
+				return false;
+			*room = *room * 10 + data[i] - '0';
+		}
+		if (i == 0 || data[i] != ':' || *room >= mm_nr_rooms)
+			return false;
+		data += i + 1;
+		len -= i + 1;
+	}
+	if (len != NUM_PEGS)
+		return false;
+	*code = 0;
+	*code_colors = 0;
+	for (i = 0; i < NUM_PEGS; i++) {
+		num = data[i] - '0';
+		if (num < 2 || num > 9)
+			return false;
+		*code = *code << 4 | num;
+		*code_colors = max_t(unsigned, *code_colors, num + 1);
+	}
+	return true;
+}
+
+/**
+ * mm_packet_deliver() - hand a parsed CS421Net code to its rooms
+ * @room: room the code is for, or -1 for every room
+ * @code: the packed code
+ * @code_colors: colors the code needs
+ *
+ * Only rooms that currently allow at least @code_colors colors accept
+ * the code; each remembers the last code of the burst it accepted.
+ *
+ * Return: true if any room accepted the code
+ */
+static bool mm_packet_deliver(int room, u64 code, unsigned code_colors)
+{
+	struct mm_room *r;
+	bool accepted = false;
+	unsigned i;
+
+	for (i = 0; i < mm_nr_rooms; i++) {
+		if (room >= 0 && i != room)
+			continue;
+		r = &mm_rooms[i];
+		if (code_colors > READ_ONCE(r->max_numbers))
+			continue;
+		r->burst_valid++;
+		r->burst_code = code;
+		r->burst_colors = code_colors;
+		accepted = true;
+	}
+	return accepted;
+}
+
+/**
+ * mm_code_publish() - broadcast a new target code to every game of a room
+ * @room: the room
+ * @code: the code, NUM_PEGS pegs packed one per nibble
+ * @code_colors: fewest colors a game needs for @code to be valid
+ *
+ * Publish the code once, under a new generation number of the room;
+ * games copy it when next played, see mm_game_sync_code(). Then wake up
+ * everyone polling the room for new codes.
+ */
+static void mm_code_publish(struct mm_room *room, u64 code,
+			    unsigned code_colors)
+{
+	write_seqlock(&room->code_lock);
+	room->code = code;
+	room->code_colors = code_colors;
+	WRITE_ONCE(room->code_gen, room->code_gen + 1);
+	write_sequnlock(&room->code_lock);
+	trace_mm_code_change(room->id, code, room->code_gen);
+	mm_stat_inc(room, code_changed);
+
+	wake_up_interruptible_poll(&room->code_wq, POLLPRI);
+}
+
 /**
  * cs421net_bottom() - bottom-half to CS421Net ISR
  * @irq: IRQ that was invoked (ignore)
  * @cookie: Pointer that was passed into request_threaded_irq()
  * (ignored)
  *
- * Fetch the incoming packet, via cs421net_get_data(). If:
- *   1. The packet length is exactly equal to four bytes, and
- *   2. If all characters in the packet are valid ASCII representation
- *      of valid digits in the code, then
- * Set the target code to the new code, and increment the number of
- * tymes the code was changed remotely. Otherwise, ignore the packet
- * and increment the number of invalid change attempts.
+ * Drain every pending packet via cs421net_get_data(), until it returns
+ * NULL, so a burst of packets costs one thread wakeup instead of one
+ * per packet. Each packet is parsed in place with mm_packet_code() and
+ * handed to its rooms with mm_packet_deliver(). Every packet that is
+ * malformed, or that no room accepts, increments the number of invalid
+ * change attempts.
  *
- * Because the payload is dynamically allocated, free it after parsing
- * it.
+ * Only the last code a room accepted in the burst matters, so it alone
+ * is set as the room's target code and counted as a remote change; the
+ * room's earlier codes are counted as superseded. Players never see a
+ * code that was replaced within the same burst.
  *
- * During Part 5, update this function to change all codes for all
- * active games.
+ * Each payload is dynamically allocated by the producer, so free it as
+ * soon as it is parsed. Nothing but each room's last code is kept.
  *
- * Remember to add appropriate spin lock calls in this function.
+ * The new code applies to every game of the room, but is only
+ * published once in the room under a new generation number; games pick
+ * it up lazily. So the publish itself takes constant time however many
+ * games exist. Waking the room's pollers does not: mm_code_publish()
+ * walks the room's code_wq, so it costs one step per process polling
+ * the room for new codes.
  *
  * <em>Caution: The incoming payload is NOT a string; it is not
  * necessarily null-terminated.</em> You CANNOT use strcpy() or
@@ -627,51 +2672,41 @@ static irqreturn_t cs421net_bottom(int irq, void *cookie)
 	/* Part 4: YOUR CODE HERE */
 	size_t len = 0;
 	char *data;
-	int i = 0;
-	int num = 0;
-	char code[4];
-	unsigned long flags;
-	struct mm_game *game_vars;
-
-	/*spin_lock_irqsave(&mm_spinlock, flags);
-	   game_vars = mm_find_game(current_uid());
-	   spin_unlock_irqrestore(&mm_spinlock, flags);
-	   if(game_vars == 0)
-	   return IRQ_HANDLED;
-	 */
-
-	data = cs421net_get_data(&len);
-
-	if (len == 4) {
-		spin_lock_irqsave(&mm_spinlock, flags);
-		for (i = 0; i < 4; i++) {
-			num = data[i] - '0';
-
-			if (num < 2 || num > max_numbers) {
-				kfree(data);
-				invalid_attempts++;
-				spin_unlock_irqrestore(&mm_spinlock, flags);
-				return IRQ_HANDLED;
-			}
-			code[i] = num;
-		}
-		/*iterates over linked list and changes the code for each */
-		if (active_games == 0) {
-			kfree(data);
-			return IRQ_HANDLED;
-		}
-		list_for_each_entry(game_vars, &game_globals, list) {
-			for (i = 0; i < 4; i++) {
-				game_vars->target_code[i] = code[i];
-			}
-		}
-		code_changed++;
-		spin_unlock_irqrestore(&mm_spinlock, flags);
-	} else {
-		invalid_attempts++;
+	unsigned i;
+	unsigned total = 0;
+	unsigned invalid = 0;
+	struct mm_room *room;
+	unsigned code_colors;
+	u64 code;
+	int target;
+
+	while ((data = cs421net_get_data(&len)) != NULL) {
+		if (!mm_packet_code(data, len, &target, &code, &code_colors) ||
+		    !mm_packet_deliver(target, code, code_colors))
+			invalid++;
+		kfree(data);
+		total++;
 	}
 
-	kfree(data);
+	if (!total)
+		return IRQ_HANDLED;
+	mm_net_stat_inc(bursts);
+	mm_net_stat_add(burst_packets, total);
+	if (total > mm_burst_max)
+		WRITE_ONCE(mm_burst_max, total);
+	if (invalid)
+		mm_net_stat_add(invalid_attempts, invalid);
+
+	for (i = 0; i < mm_nr_rooms; i++) {
+		room = &mm_rooms[i];
+		if (!room->burst_valid)
+			continue;
+		if (room->burst_valid > 1)
+			mm_stat_add(room, codes_superseded,
+				    room->burst_valid - 1);
+		room->burst_valid = 0;
+		mm_code_publish(room, room->burst_code, room->burst_colors);
+	}
 	return IRQ_HANDLED;
 }
 
@@ -685,38 +2720,267 @@ static irqreturn_t cs421net_bottom(int irq, void *cookie)
  *
  * Write to @buf, up to PAGE_SIZE characters, a human-readable message
  * containing these game statistics:
- *  - Number of colors (range of digits in target code)
+ *  - Number of colors (range of digits in target code) of the first room
  *   - Number of started games
  *   - Number of active games
  *   - Number of valid network messages (see Part 4)
  *   - Number of invalid network messages (see Part 4)
+ *   - Number of scored guesses
+ *   - Average time a player held a game lock
  * Note that @buf is a normal character buffer, not a __user
  * buffer. Use scnprintf() in this function.
  *
+ * Counters are totals over every room. The full set of counters, and
+ * each room's own, are in debugfs, see mm_debugfs_stats_show().
+ *
  * @return Number of bytes written to @buf, or negative on error.
  */
 static ssize_t mm_stats_show(struct device *dev,
 			     struct device_attribute *attr, char *buf)
 {
 	/* Part 3: YOUR CODE HERE */
-	int numbytes = 0;
-	unsigned long flags;
+	struct mm_stats sum;
+	struct mm_net_stats net;
 
-	spin_lock_irqsave(&mm_spinlock, flags);
-	numbytes = scnprintf(buf, PAGE_SIZE, "CS421 Mastermind Stats\n\
+	mm_stats_sum(NULL, &sum);
+	mm_net_stats_sum(&net);
+	return scnprintf(buf, PAGE_SIZE, "CS421 Mastermind Stats\n\
 Number of colors: %d\n\
-Number of started games: %d\n\
-Number of active games: %d\n\
-Number of valid code changes: %d\n\
-Number of invalid network messages: %d\n", max_numbers, game_count, active_games, code_changed, invalid_attempts);
+Number of started games: %llu\n\
+Number of active games: %ld\n\
+Number of valid code changes: %llu\n\
+Number of invalid network messages: %llu\n\
+Number of scored guesses: %llu\n\
+Average lock hold time: %llu ns\n\
+Number of reclaimed games: %llu\n", READ_ONCE(mm_rooms[0].max_numbers), sum.game_count, sum.active_games, sum.code_changed, net.invalid_attempts, sum.guesses, sum.lock_holds ? div64_u64(sum.lock_hold_ns, sum.lock_holds) : 0, sum.reclaimed_idle + sum.reclaimed_shrinker);
+}
+
+static DEVICE_ATTR(stats, S_IRUGO, mm_stats_show, NULL);
+
+/**
+ * mm_leaderboard_show() - callback invoked when a process reads from
+ * /sys/devices/platform/mastermind/leaderboard
+ *
+ * @dev: device driver data for sysfs entry (ignored)
+ * @attr: sysfs entry context (ignored)
+ * @buf: destination to store the leaderboard
+ *
+ * Write one line per ranked game, best first: its rank, owner's uid,
+ * guesses it took to win, and number of colors. The board is copied
+ * under the read side of mm_board_lock, retrying if a game was won
+ * meanwhile, so reading never holds up a player.
+ *
+ * @return Number of bytes written to @buf
+ */
+static ssize_t mm_leaderboard_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct mm_board_entry board[MM_BOARD_SIZE];
+	unsigned len;
+	unsigned seq;
+	unsigned i;
+	ssize_t n = 0;
+
+	do {
+		seq = read_seqbegin(&mm_board_lock);
+		len = mm_board_len;
+		memcpy(board, mm_board_snap, len * sizeof(board[0]));
+	} while (read_seqretry(&mm_board_lock, seq));
+
+	for (i = 0; i < len; i++)
+		n += scnprintf(buf + n, PAGE_SIZE - n,
+			       "%u uid %u guesses %u colors %u\n", i + 1,
+			       from_kuid(&init_user_ns, board[i].uid),
+			       board[i].guesses, board[i].colors);
+	return n;
+}
 
-	spin_unlock_irqrestore(&mm_spinlock, flags);
+static DEVICE_ATTR(leaderboard, S_IRUGO, mm_leaderboard_show, NULL);
 
-	pr_info("numbytes = %d", numbytes);
-	return numbytes;
+/**
+ * mm_debugfs_stats_show() - print every counter for scripts
+ * @m: seq_file of /sys/kernel/debug/mastermind/stats, whose private
+ * data is NULL, or of /sys/kernel/debug/mastermind/room<N>, whose
+ * private data is that room
+ * @v: unused
+ *
+ * One "name value" pair per line. guess_latency_lt_<N>ns counts the
+ * guesses scored in less than N nanoseconds, but not in less than the
+ * previous bucket's N.
+ *
+ * The stats file adds up every room, and also has the CS421Net
+ * counters, which belong to no room. Its colors are those of the first
+ * room.
+ *
+ * Return: always 0
+ */
+static int mm_debugfs_stats_show(struct seq_file *m, void *v)
+{
+	struct mm_room *room = m->private;
+	struct mm_stats sum;
+	struct mm_net_stats net;
+	int i;
+
+	mm_stats_sum(room, &sum);
+	if (!room)
+		seq_printf(m, "rooms %u\n", mm_nr_rooms);
+	seq_printf(m, "colors %d\n",
+		   READ_ONCE((room ? room : &mm_rooms[0])->max_numbers));
+	seq_printf(m, "games_started %llu\n", sum.game_count);
+	seq_printf(m, "games_active %ld\n", sum.active_games);
+	seq_printf(m, "code_changes %llu\n", sum.code_changed);
+	if (!room) {
+		mm_net_stats_sum(&net);
+		seq_printf(m, "invalid_messages %llu\n", net.invalid_attempts);
+	}
+	seq_printf(m, "guesses %llu\n", sum.guesses);
+	for (i = 0; i < MM_OP_COUNT; i++)
+		seq_printf(m, "op_%s %llu\n", mm_op_names[i], sum.ops[i]);
+	for (i = 0; i < MM_LAT_BUCKETS; i++)
+		seq_printf(m, "guess_latency_lt_%lluns %llu\n", 1ULL << i,
+			   sum.guess_latency[i]);
+	seq_printf(m, "lock_holds %llu\n", sum.lock_holds);
+	seq_printf(m, "lock_hold_ns %llu\n", sum.lock_hold_ns);
+	seq_printf(m, "games_reclaimed_idle %llu\n", sum.reclaimed_idle);
+	seq_printf(m, "games_reclaimed_shrinker %llu\n",
+		   sum.reclaimed_shrinker);
+	if (!room) {
+		seq_printf(m, "net_bursts %llu\n", net.bursts);
+		seq_printf(m, "net_burst_packets %llu\n", net.burst_packets);
+		seq_printf(m, "net_burst_max %u\n", READ_ONCE(mm_burst_max));
+	}
+	seq_printf(m, "net_codes_superseded %llu\n", sum.codes_superseded);
+	return 0;
 }
 
-static DEVICE_ATTR(stats, S_IRUGO, mm_stats_show, NULL);
+static int mm_debugfs_stats_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, mm_debugfs_stats_show, inode->i_private);
+}
+
+static const struct file_operations mm_debugfs_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = mm_debugfs_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+/**
+ * mm_rooms_unregister() - remove the devices of the rooms
+ * @nr: number of rooms, from the first, whose devices are registered
+ */
+static void mm_rooms_unregister(unsigned nr)
+{
+	unsigned i;
+
+	for (i = 0; i < nr; i++) {
+		misc_deregister(&mm_rooms[i].ctl_dev);
+		misc_deregister(&mm_rooms[i].dev);
+	}
+}
+
+/**
+ * mm_rooms_free() - free the rooms and their statistics
+ *
+ * The rooms' devices must be unregistered and their games freed.
+ */
+static void mm_rooms_free(void)
+{
+	unsigned i;
+
+	for (i = 0; i < mm_nr_rooms; i++)
+		free_percpu(mm_rooms[i].stats);
+	kfree(mm_rooms);
+	mm_rooms = NULL;
+	mm_nr_rooms = 0;
+}
+
+/**
+ * mm_room_init() - set up a room's game table, code and statistics
+ * @room: the room, zeroed
+ * @id: index of the room
+ *
+ * Return: 0 on success, -ENOMEM if the statistics could not be allocated
+ */
+static int mm_room_init(struct mm_room *room, unsigned id)
+{
+	room->id = id;
+	room->max_numbers = NUM_COLORS;
+	hash_init(room->games);
+	spin_lock_init(&room->table_lock);
+	seqlock_init(&room->code_lock);
+	init_waitqueue_head(&room->code_wq);
+	room->stats = alloc_percpu(struct mm_stats);
+	return room->stats ? 0 : -ENOMEM;
+}
+
+/**
+ * mm_rooms_create() - allocate the rooms and register their devices
+ *
+ * A single room keeps the names /dev/mm and /dev/mm_ctl. With more,
+ * room N gets /dev/mmN and /dev/mm_ctlN.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_rooms_create(void)
+{
+	struct mm_room *room;
+	unsigned i;
+	int err;
+
+	if (rooms < 1 || rooms > MM_MAX_ROOMS) {
+		pr_err("rooms must be between 1 and %d\n", MM_MAX_ROOMS);
+		return -EINVAL;
+	}
+	mm_rooms = kcalloc(rooms, sizeof(*mm_rooms), GFP_KERNEL);
+	if (!mm_rooms)
+		return -ENOMEM;
+	mm_nr_rooms = rooms;
+
+	for (i = 0; i < mm_nr_rooms; i++) {
+		if (mm_room_init(&mm_rooms[i], i)) {
+			mm_rooms_free();
+			return -ENOMEM;
+		}
+	}
+
+	for (i = 0; i < mm_nr_rooms; i++) {
+		room = &mm_rooms[i];
+		if (mm_nr_rooms == 1) {
+			strscpy(room->name, "mm", sizeof(room->name));
+			strscpy(room->ctl_name, "mm_ctl", sizeof(room->ctl_name));
+		} else {
+			snprintf(room->name, sizeof(room->name), "mm%u", i);
+			snprintf(room->ctl_name, sizeof(room->ctl_name),
+				 "mm_ctl%u", i);
+		}
+		room->dev.minor = MISC_DYNAMIC_MINOR;
+		room->dev.name = room->name;
+		room->dev.fops = &mm_fops;
+		room->dev.mode = 0666;
+		room->ctl_dev.minor = MISC_DYNAMIC_MINOR;
+		room->ctl_dev.name = room->ctl_name;
+		room->ctl_dev.fops = &mm_ctl_fops;
+		room->ctl_dev.mode = 0666;
+
+		err = misc_register(&room->dev);
+		if (err)
+			goto fail;
+		err = misc_register(&room->ctl_dev);
+		if (err) {
+			misc_deregister(&room->dev);
+			goto fail;
+		}
+	}
+	return 0;
+
+fail:
+	pr_err("Could not register the devices of room %u\n", i);
+	mm_rooms_unregister(i);
+	mm_rooms_free();
+	return err;
+}
 
 /**
  * mastermind_probe() - callback invoked when this driver is probed
@@ -729,29 +2993,32 @@ static int mastermind_probe(struct platform_device *pdev)
 	/* Merge the contents of your original mastermind_init() here. */
 	/* Part 1: YOUR CODE HERE */
 
+	char name[8];
+	unsigned i;
 	int err;
-	unsigned long flags;
 
-	spin_lock_irqsave(&mm_spinlock, flags);
 	pr_info("Initializing the game.\n");
 
 	/* YOUR CODE HERE */
-	max_numbers = NUM_COLORS;
-	spin_unlock_irqrestore(&mm_spinlock, flags);
+	mm_game_cache = KMEM_CACHE(mm_game, 0);
+	if (!mm_game_cache)
+		return -ENOMEM;
 
 	cs421net_enable();
 
-	err = misc_register(&mm_device);	/*registers misc character device returns error if failed */
+	err = mm_rooms_create();	/*registers every room's devices */
 	if (err)
 		goto fail_mm;
-	err = misc_register(&mm_ctl_device);	/*registers mm_ctl_device */
-	if (err)
-		goto fail_mm_ctl;
 	err = device_create_file(&pdev->dev, &dev_attr_stats);
 	if (err) {
 		pr_err("Could not create sysfs entry\n");
 		goto fail_create_file;
 	}
+	err = device_create_file(&pdev->dev, &dev_attr_leaderboard);
+	if (err) {
+		pr_err("Could not create sysfs entry\n");
+		goto fail_create_board;
+	}
 	err =
 	    request_threaded_irq(CS421NET_IRQ, cs421net_top, cs421net_bottom, 0,
 				 "mm_Set_Code", NULL);
@@ -759,13 +3026,33 @@ static int mastermind_probe(struct platform_device *pdev)
 		pr_err("Was unable to register Interrupt handler\n");
 		goto fail_irq_reg;
 	}
+	err = mm_shrinker_register();
+	if (err) {
+		pr_err("Could not register the shrinker\n");
+		goto fail_shrinker;
+	}
+	schedule_delayed_work(&mm_reap_work, MM_REAP_INTERVAL);
+
+	/*debugfs is optional, so failing to create it is not an error */
+	mm_debugfs = debugfs_create_dir("mastermind", NULL);
+	debugfs_create_file("stats", S_IRUGO, mm_debugfs, NULL,
+			    &mm_debugfs_stats_fops);
+	for (i = 0; i < mm_nr_rooms; i++) {
+		snprintf(name, sizeof(name), "room%u", i);
+		debugfs_create_file(name, S_IRUGO, mm_debugfs, &mm_rooms[i],
+				    &mm_debugfs_stats_fops);
+	}
 	return err;
 
 	//failed registrations
-fail_irq_reg:device_remove_file(&pdev->dev, &dev_attr_stats);
-fail_create_file:misc_deregister(&mm_ctl_device);
-fail_mm_ctl:misc_deregister(&mm_device);
-fail_mm:return err;
+fail_shrinker:free_irq(CS421NET_IRQ, NULL);
+fail_irq_reg:device_remove_file(&pdev->dev, &dev_attr_leaderboard);
+fail_create_board:device_remove_file(&pdev->dev, &dev_attr_stats);
+fail_create_file:mm_rooms_unregister(mm_nr_rooms);
+	mm_rooms_free();
+fail_mm:cs421net_disable();
+	kmem_cache_destroy(mm_game_cache);
+	return err;
 
 }
 
@@ -779,29 +3066,43 @@ static int mastermind_remove(struct platform_device *pdev)
 {
 	/* Merge the contents of your original mastermind_exit() here. */
 	/* Part 1: YOUR CODE HERE */
-	unsigned long flags;
-
-	spin_lock_irqsave(&mm_spinlock, flags);
 	pr_info("Freeing resources.\n");
-	mm_free_games();
-	spin_unlock_irqrestore(&mm_spinlock, flags);
 
 	/* YOUR CODE HERE */
+	debugfs_remove_recursive(mm_debugfs);
 	cs421net_disable();
-	misc_deregister(&mm_device);	/*undo's the registration from init */
-	misc_deregister(&mm_ctl_device);	/*undo's the mm_ctl registration from init */
+	mm_rooms_unregister(mm_nr_rooms);	/*undo's the registrations from init */
 	device_remove_file(&pdev->dev, &dev_attr_stats);
+	device_remove_file(&pdev->dev, &dev_attr_leaderboard);
 	free_irq(CS421NET_IRQ, NULL);
+	cancel_delayed_work_sync(&mm_reap_work);
+	mm_shrinker_unregister();
+
+	/*nothing can reach the games anymore, so they can be freed */
+	mm_free_games();
+	mm_rooms_free();
+	kmem_cache_destroy(mm_game_cache);
 
 	return 0;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+/* platform_driver's remove callback returns void since 6.11 */
+static void mastermind_remove_void(struct platform_device *pdev)
+{
+	mastermind_remove(pdev);
+}
+#define MM_PLATFORM_REMOVE mastermind_remove_void
+#else
+#define MM_PLATFORM_REMOVE mastermind_remove
+#endif
+
 static struct platform_driver cs421_driver = {
 	.driver = {
 		   .name = "mastermind",
 		   },
 	.probe = mastermind_probe,
-	.remove = mastermind_remove,
+	.remove = MM_PLATFORM_REMOVE,
 };
 
 static struct platform_device *pdev;
@@ -835,5 +3136,14 @@ static void __exit cs421_exit(void)
 module_init(cs421_init);
 module_exit(cs421_exit);
 
+/*
+ * The KUnit suite needs the static functions above, so it is part of
+ * this file. It is only built into the kernel, since kunit_test_suites()
+ * of older kernels claims module_init() when built as a module.
+ */
+#if IS_ENABLED(CONFIG_KUNIT) && !defined(MODULE)
+#include "mastermind2_kunit.c"
+#endif
+
 MODULE_DESCRIPTION("CS421 Mastermind Game++");
 MODULE_LICENSE("GPL");
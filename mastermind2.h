@@ -0,0 +1,240 @@
+/**
+ * Userspace interface of the mastermind2 driver, shared by the kernel
+ * module and the programs that talk to /dev/mm.
+ */
+
+#ifndef MASTERMIND2_H
+#define MASTERMIND2_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * MM_MAX_BATCH - most guesses a single write to /dev/mm scores
+ *
+ * A longer write is consumed only up to this many guesses, and a read
+ * returns the four character result of each guess of the last write.
+ * Guesses are written as one hexadecimal digit per peg.
+ */
+#define MM_MAX_BATCH 32
+
+/**
+ * MM_ABI_VERSION - version of the ioctl interface below
+ *
+ * Bumped whenever a request is added or a reserved field gains a
+ * meaning. Query it with MM_IOC_VERSION. Reserved fields must be zero.
+ */
+#define MM_ABI_VERSION 3
+
+/* room in the ioctl structures for codes of up to this many pegs */
+#define MM_IOC_MAX_PEGS 16
+
+/* value of mm_ioc_state.black and .white before the first guess */
+#define MM_IOC_NO_SCORE 0xff
+
+/**
+ * struct mm_ioc_start - argument of MM_IOC_START
+ * @pegs: pegs in the code, up to MM_IOC_MAX_PEGS, or 0 for the default
+ * of 4 (since ABI version 2; version 1 only accepted the defaults)
+ * @colors: colors of the code, 2 to 16, or 0 for the number set
+ * through /dev/mm_ctl
+ * @flags: must be 0
+ * @reserved: must be 0
+ */
+struct mm_ioc_start {
+	__u8 pegs;
+	__u8 colors;
+	__u16 flags;
+	__u32 reserved;
+};
+
+/**
+ * struct mm_ioc_guess - argument of MM_IOC_GUESS
+ * @pegs: *IN* the guess, one color number (not ASCII digit) per peg,
+ * each below the game's number of colors; unused pegs must be 0
+ * @black: *OUT* pegs of the right color in the right position
+ * @white: *OUT* pegs of the right color in the wrong position
+ * @active: *OUT* nonzero if the game is still going, 0 if it was won
+ * @reserved: must be 0
+ * @num_guesses: *OUT* guesses made in this game so far
+ */
+struct mm_ioc_guess {
+	__u8 pegs[MM_IOC_MAX_PEGS];
+	__u8 black;
+	__u8 white;
+	__u8 active;
+	__u8 reserved;
+	__u32 num_guesses;
+};
+
+/**
+ * struct mm_ioc_state - argument of MM_IOC_GET_STATE
+ * @num_guesses: guesses made in this game so far
+ * @active: nonzero if a game is going
+ * @black: black pegs of the last guess, or MM_IOC_NO_SCORE
+ * @white: white pegs of the last guess, or MM_IOC_NO_SCORE
+ * @pegs: pegs in the code
+ * @colors: colors of the code
+ * @reserved: always 0
+ */
+struct mm_ioc_state {
+	__u32 num_guesses;
+	__u8 active;
+	__u8 black;
+	__u8 white;
+	__u8 pegs;
+	__u8 colors;
+	__u8 reserved[7];
+};
+
+/*
+ * mmap() offsets of the regions of /dev/mm, in pages. All of them can
+ * only be mapped read-only.
+ */
+
+/* the text of the game so far, one page */
+#define MM_MMAP_VIEW_PGOFF 0
+
+/* the history ring: a struct mm_ring_header page, then the data pages */
+#define MM_MMAP_RING_PGOFF 1
+
+/* data pages in the history ring */
+#define MM_RING_PAGES 8
+
+/**
+ * struct mm_ring_header - first page of the history ring
+ * @head: bytes ever written; the next byte goes to data[@head % @size]
+ * @tail: oldest byte still in the ring; @head - @tail <= @size
+ * @size: bytes of data in the ring
+ * @data_offset: distance from this header to the first data byte
+ *
+ * The ring streams the same lines as the view, from when it was first
+ * mapped on, with a "New game" line at each start. Unlike the view it
+ * is not cleared when a game starts; it drops the oldest bytes when
+ * full instead. @head and @tail
+ * only grow, and wrap around at 2^32. To consume it, load @head with
+ * acquire semantics, copy the bytes from your own cursor up to @head,
+ * then load @tail again: any copied byte before it was overwritten
+ * while copying and has to be discarded.
+ */
+struct mm_ring_header {
+	__u32 head;
+	__u32 tail;
+	__u32 size;
+	__u32 data_offset;
+};
+
+/* the game's struct mm_shared_state, one page */
+#define MM_MMAP_STATE_PGOFF (MM_MMAP_RING_PGOFF + 1 + MM_RING_PAGES)
+
+/**
+ * struct mm_shared_state - state of a game, readable without syscalls
+ * @seq: odd while the driver is updating the fields below
+ * @num_guesses: guesses made in this game so far
+ * @last_result: result of the most recent guess, as read() returns it
+ * while the game is active
+ * @game_active: nonzero if a game is going
+ * @pegs: pegs in the game's code (since ABI version 2)
+ * @colors: colors of the game's code (since ABI version 2)
+ * @reserved: always 0
+ * @code_gen: generation of the CS421Net code the target was last set
+ * from, as of the game's last guess
+ *
+ * Map it at MM_MMAP_STATE_PGOFF and read it with
+ * mm_shared_state_read().
+ */
+struct mm_shared_state {
+	__u32 seq;
+	__u32 num_guesses;
+	char last_result[4];
+	__u32 game_active;
+	__u8 pegs;
+	__u8 colors;
+	__u8 reserved[6];
+	__u64 code_gen;
+};
+
+#ifndef __KERNEL__
+/**
+ * mm_shared_state_read() - take a consistent snapshot of a game's state
+ * @shared: the mapped struct mm_shared_state
+ * @out: *OUT* parameter, receives the snapshot
+ *
+ * Retries while the driver is updating the page, like a seqcount
+ * reader in the kernel.
+ */
+static inline void mm_shared_state_read(const struct mm_shared_state *shared,
+					struct mm_shared_state *out)
+{
+	__u32 seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		__builtin_memcpy(out, (const void *)shared, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) == seq)
+			return;
+	}
+}
+#endif
+
+#define MM_IOC_MAGIC 'M'
+
+/**
+ * MM_IOC_PRIVATE - give this /dev/mm file a game of its own
+ *
+ * The file stops playing its uid's game, and instead plays a newly
+ * started game that only it can reach. The game ends when the file is
+ * closed, which lets a single uid run many games in parallel.
+ */
+#define MM_IOC_PRIVATE _IO(MM_IOC_MAGIC, 0x00)
+
+/* MM_IOC_VERSION - store MM_ABI_VERSION of the driver in a __u32 */
+#define MM_IOC_VERSION _IOR(MM_IOC_MAGIC, 0x01, __u32)
+
+/* MM_IOC_START - start or restart the file's game, like "start" */
+#define MM_IOC_START _IOW(MM_IOC_MAGIC, 0x02, struct mm_ioc_start)
+
+/* MM_IOC_QUIT - end the file's game, like "quit" */
+#define MM_IOC_QUIT _IO(MM_IOC_MAGIC, 0x03)
+
+/* MM_IOC_GUESS - score one guess, like writing it to /dev/mm */
+#define MM_IOC_GUESS _IOWR(MM_IOC_MAGIC, 0x04, struct mm_ioc_guess)
+
+/* MM_IOC_GET_STATE - describe the file's game */
+#define MM_IOC_GET_STATE _IOR(MM_IOC_MAGIC, 0x05, struct mm_ioc_state)
+
+/*
+ * io_uring commands (since ABI version 3, on kernels of 5.19 and up;
+ * older kernels build the module without them).
+ * Submit an IORING_OP_URING_CMD SQE on a /dev/mm file with cmd_op set
+ * to one of the values below and its structure in the SQE's cmd area,
+ * which holds 16 bytes in a regular SQE. The CQE's res is the result.
+ */
+
+/**
+ * struct mm_uring_guess - command of MM_URING_GUESS
+ * @code: the guess, one color per nibble, first peg in the highest
+ * nibble used; 4211 is 0x4211
+ * @reserved: must be 0
+ */
+struct mm_uring_guess {
+	__u64 code;
+	__u64 reserved;
+};
+
+/* set in the result of MM_URING_GUESS unless the guess won the game */
+#define MM_URING_ACTIVE (1 << 16)
+
+/*
+ * MM_URING_GUESS - score one guess, like MM_IOC_GUESS. The result is
+ * MM_SCORE(black, white) from mastermind2_score.h, plus MM_URING_ACTIVE.
+ */
+#define MM_URING_GUESS _IOW(MM_IOC_MAGIC, 0x20, struct mm_uring_guess)
+
+/* MM_URING_START - start or restart the file's game, like MM_IOC_START */
+#define MM_URING_START _IOW(MM_IOC_MAGIC, 0x21, struct mm_ioc_start)
+
+#endif
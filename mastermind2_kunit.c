@@ -0,0 +1,613 @@
+/**
+ * KUnit tests and microbenchmarks of the mastermind2 game core.
+ *
+ * This file is not built on its own: mastermind2.c includes it at its
+ * end when the kernel has CONFIG_KUNIT, so the tests can reach the
+ * driver's static functions. Build mastermind2.c into a UML or QEMU
+ * kernel (for example with "obj-y += mastermind2.o" in a drivers/
+ * Makefile) and run
+ *   ./tools/testing/kunit/kunit.py run 'mastermind2*'
+ *
+ * The benchmarks print their timings with kunit_info(); they fail
+ * nothing, so compare the numbers against an earlier run.
+ *
+ * Every case gets a room of its own from mm_kunit_init(), so nothing
+ * here needs mastermind_probe(), CS421Net or its interrupt, and no case
+ * touches the games or codes of a driver that is running.
+ */
+
+#include <kunit/test.h>
+
+/* games the lookup and broadcast benchmarks create */
+#define MM_KUNIT_GAMES 10000
+
+/* uids of the test games, far above any real user's */
+#define MM_KUNIT_UID_BASE 0x7ff00000
+
+/**
+ * struct mm_kunit_ctx - what mm_kunit_init() leaves in test->priv
+ * @room: a room of the test's own, which no device, handler or reaper
+ * can reach
+ * @own_cache: true if mm_kunit_init() created mm_game_cache
+ * @own_rooms: true if @room stands in for mm_rooms
+ */
+struct mm_kunit_ctx {
+	struct mm_room room;
+	bool own_cache;
+	bool own_rooms;
+};
+
+/**
+ * mm_kunit_init() - give a test case a room of its own
+ * @test: the test
+ *
+ * The game cache is created here if the driver was never probed, as in
+ * a kunit.py kernel. Then there are no rooms either, and the test room
+ * stands in as the only one, so that mm_packet_code() knows a room 0.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_kunit_init(struct kunit *test)
+{
+	struct mm_kunit_ctx *ctx;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	if (!ctx || mm_room_init(&ctx->room, 0))
+		return -ENOMEM;
+	if (!mm_game_cache) {
+		mm_game_cache = KMEM_CACHE(mm_game, 0);
+		if (!mm_game_cache) {
+			free_percpu(ctx->room.stats);
+			return -ENOMEM;
+		}
+		ctx->own_cache = true;
+	}
+	if (!mm_rooms) {
+		mm_rooms = &ctx->room;
+		mm_nr_rooms = 1;
+		ctx->own_rooms = true;
+	}
+	test->priv = ctx;
+	return 0;
+}
+
+/**
+ * mm_kunit_exit() - undo mm_kunit_init()
+ * @test: the test
+ *
+ * Games a failed case left in the test room are freed here too.
+ */
+static void mm_kunit_exit(struct kunit *test)
+{
+	struct mm_kunit_ctx *ctx = test->priv;
+
+	if (ctx->own_rooms) {
+		mm_rooms = NULL;
+		mm_nr_rooms = 0;
+	}
+	mm_room_free_games(&ctx->room);
+	rcu_barrier();
+	if (ctx->own_cache) {
+		kmem_cache_destroy(mm_game_cache);
+		mm_game_cache = NULL;
+	}
+	free_percpu(ctx->room.stats);
+}
+
+/* the room of the running test case */
+static struct mm_room *mm_kunit_room(struct kunit *test)
+{
+	struct mm_kunit_ctx *ctx = test->priv;
+
+	return &ctx->room;
+}
+
+/* random numbers that are the same on every run */
+static u64 mm_kunit_rand(u64 *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* score @guess against @target the slow way, peg against peg */
+static void mm_kunit_ref_pegs(u64 target, u64 guess, unsigned pegs,
+			      unsigned *black, unsigned *white)
+{
+	bool target_used[MM_MAX_PEGS] = { false };
+	bool guess_used[MM_MAX_PEGS] = { false };
+	unsigned i;
+	unsigned j;
+
+	*black = 0;
+	*white = 0;
+	for (i = 0; i < pegs; i++) {
+		if (((target >> (4 * i)) & 0xf) == ((guess >> (4 * i)) & 0xf)) {
+			target_used[i] = true;
+			guess_used[i] = true;
+			(*black)++;
+		}
+	}
+	for (i = 0; i < pegs; i++) {
+		if (guess_used[i])
+			continue;
+		for (j = 0; j < pegs; j++) {
+			if (!target_used[j] &&
+			    ((target >> (4 * j)) & 0xf) ==
+			    ((guess >> (4 * i)) & 0xf)) {
+				target_used[j] = true;
+				(*white)++;
+				break;
+			}
+		}
+	}
+}
+
+/* the code of index @i among all codes of @pegs pegs of @colors colors */
+static u64 mm_kunit_code(unsigned long i, unsigned pegs, unsigned colors)
+{
+	u64 code = 0;
+	unsigned k;
+
+	for (k = 0; k < pegs; k++) {
+		code |= (u64)(i % colors) << (4 * k);
+		i /= colors;
+	}
+	return code;
+}
+
+/* compare mm_num_pegs() against the reference over every code pair */
+static void mm_kunit_check_shape(struct kunit *test, unsigned pegs,
+				 unsigned colors)
+{
+	unsigned long ncodes = 1;
+	unsigned long t;
+	unsigned long g;
+	unsigned black;
+	unsigned white;
+	unsigned ref_black;
+	unsigned ref_white;
+	u64 target;
+	u64 guess;
+	unsigned k;
+
+	for (k = 0; k < pegs; k++)
+		ncodes *= colors;
+	for (t = 0; t < ncodes; t++) {
+		target = mm_kunit_code(t, pegs, colors);
+		for (g = 0; g < ncodes; g++) {
+			guess = mm_kunit_code(g, pegs, colors);
+			mm_num_pegs(target, guess, pegs, &black, &white);
+			mm_kunit_ref_pegs(target, guess, pegs, &ref_black,
+					  &ref_white);
+			KUNIT_ASSERT_EQ_MSG(test, black, ref_black,
+					    "target %llx guess %llx", target,
+					    guess);
+			KUNIT_ASSERT_EQ_MSG(test, white, ref_white,
+					    "target %llx guess %llx", target,
+					    guess);
+		}
+		cond_resched();
+	}
+}
+
+static void mm_kunit_num_pegs_default(struct kunit *test)
+{
+	mm_kunit_check_shape(test, NUM_PEGS, NUM_COLORS);
+}
+
+static void mm_kunit_num_pegs_shapes(struct kunit *test)
+{
+	mm_kunit_check_shape(test, 1, MM_MAX_COLORS);
+	mm_kunit_check_shape(test, 2, MM_MAX_COLORS);
+	mm_kunit_check_shape(test, 3, 10);
+	mm_kunit_check_shape(test, 6, 3);
+	mm_kunit_check_shape(test, 10, 2);
+}
+
+/* shapes too large for every pair get random pairs instead */
+static void mm_kunit_num_pegs_random(struct kunit *test)
+{
+	u64 state = 0x9e3779b97f4a7c15ULL;
+	unsigned black;
+	unsigned white;
+	unsigned ref_black;
+	unsigned ref_white;
+	unsigned pegs;
+	u64 target;
+	u64 guess;
+	unsigned i;
+
+	for (i = 0; i < 200000; i++) {
+		pegs = 1 + mm_kunit_rand(&state) % MM_MAX_PEGS;
+		target = mm_kunit_rand(&state);
+		guess = mm_kunit_rand(&state);
+		/*few colors, so pegs often match */
+		if (i & 1) {
+			target &= 0x3333333333333333ULL;
+			guess &= 0x3333333333333333ULL;
+		}
+		if (pegs < MM_MAX_PEGS) {
+			target &= (1ULL << (4 * pegs)) - 1;
+			guess &= (1ULL << (4 * pegs)) - 1;
+		}
+		mm_num_pegs(target, guess, pegs, &black, &white);
+		mm_kunit_ref_pegs(target, guess, pegs, &ref_black, &ref_white);
+		KUNIT_ASSERT_EQ(test, black, ref_black);
+		KUNIT_ASSERT_EQ(test, white, ref_white);
+	}
+}
+
+/* one case of mm_kunit_ctl_parse() */
+struct mm_kunit_ctl_case {
+	const char *input;
+	int ret;
+	enum mm_ctl_cmd cmd;
+	unsigned pegs;
+	unsigned colors;
+};
+
+static const struct mm_kunit_ctl_case mm_kunit_ctl_cases[] = {
+	{ "start", 0, MM_CTL_START, NUM_PEGS, 0 },
+	{ "start 6 8", 0, MM_CTL_START, 6, 8 },
+	{ "start 16 16", 0, MM_CTL_START, 16, 16 },
+	{ "start 6 8\n", 0, MM_CTL_START, 6, 8 },
+	{ "quit", 0, MM_CTL_QUIT },
+	{ "colors 2", 0, MM_CTL_COLORS, 0, 2 },
+	{ "colors 16", 0, MM_CTL_COLORS, 0, 16 },
+	{ "colors 9\n", 0, MM_CTL_COLORS, 0, 9 },
+	{ "", -EINVAL },
+	{ "started", -EINVAL },
+	{ "start\n", -EINVAL },
+	{ "start 0 6", -EINVAL },
+	{ "start 17 6", -EINVAL },
+	{ "start 4 1", -EINVAL },
+	{ "start 4 17", -EINVAL },
+	{ "start 4", -EINVAL },
+	{ "start 4 6 x", -EINVAL },
+	{ "quitx", -EINVAL },
+	{ "colors", -EINVAL },
+	{ "colors 1", -EINVAL },
+	{ "colors 17", -EINVAL },
+	{ "colors x", -EINVAL },
+	{ "stop", -EINVAL },
+};
+
+static void mm_kunit_ctl_parse(struct kunit *test)
+{
+	const struct mm_kunit_ctl_case *c;
+	struct mm_ctl_req req;
+	char input[17];
+	size_t count;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(mm_kunit_ctl_cases); i++) {
+		c = &mm_kunit_ctl_cases[i];
+		count = strlen(c->input);
+		memcpy(input, c->input, count + 1);
+		KUNIT_EXPECT_EQ_MSG(test, mm_ctl_parse(input, count, &req),
+				    c->ret, "input \"%s\"", c->input);
+		if (c->ret != 0)
+			continue;
+		KUNIT_EXPECT_EQ_MSG(test, req.cmd, c->cmd, "input \"%s\"",
+				    c->input);
+		if (c->cmd == MM_CTL_START)
+			KUNIT_EXPECT_EQ_MSG(test, req.pegs, c->pegs,
+					    "input \"%s\"", c->input);
+		KUNIT_EXPECT_EQ_MSG(test, req.colors, c->colors,
+				    "input \"%s\"", c->input);
+	}
+}
+
+/* one case of mm_kunit_packet_code() */
+struct mm_kunit_packet_case {
+	const char *data;
+	bool valid;
+	int room;
+	u64 code;
+	unsigned colors;
+};
+
+static const struct mm_kunit_packet_case mm_kunit_packet_cases[] = {
+	{ "2345", true, -1, 0x2345, 6 },
+	{ "2999", true, -1, 0x2999, 10 },
+	{ "0:4321", false },
+	{ "0:4322", true, 0, 0x4322, 5 },
+	{ "00:2222", true, 0, 0x2222, 3 },
+	{ "1234", false },
+	{ "234", false },
+	{ "23456", false },
+	{ "2a45", false },
+	{ ":2345", false },
+	{ "x:2345", false },
+	{ "0-2345", false },
+	{ "64:2345", false },
+	{ "100:2345", false },
+};
+
+static void mm_kunit_packet_code(struct kunit *test)
+{
+	const struct mm_kunit_packet_case *c;
+	unsigned colors;
+	u64 code;
+	int room;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(mm_kunit_packet_cases); i++) {
+		c = &mm_kunit_packet_cases[i];
+		KUNIT_EXPECT_EQ_MSG(test, mm_packet_code(c->data,
+							 strlen(c->data),
+							 &room, &code,
+							 &colors),
+				    c->valid, "packet \"%s\"", c->data);
+		if (!c->valid)
+			continue;
+		KUNIT_EXPECT_EQ_MSG(test, room, c->room, "packet \"%s\"",
+				    c->data);
+		KUNIT_EXPECT_EQ_MSG(test, code, c->code, "packet \"%s\"",
+				    c->data);
+		KUNIT_EXPECT_EQ_MSG(test, colors, c->colors, "packet \"%s\"",
+				    c->data);
+	}
+}
+
+static kuid_t mm_kunit_uid(unsigned i)
+{
+	return make_kuid(&init_user_ns, MM_KUNIT_UID_BASE + i);
+}
+
+/**
+ * mm_kunit_drop_games() - drop the test's references and free its games
+ * @room: room of the games
+ * @games: games returned by mm_find_game()
+ * @n: number of @games
+ *
+ * mm_game_try_reclaim() wants the reference dropped under the room's
+ * table_lock.
+ */
+static void mm_kunit_drop_games(struct mm_room *room, struct mm_game **games,
+				unsigned n)
+{
+	unsigned i;
+
+	spin_lock(&room->table_lock);
+	for (i = 0; i < n; i++) {
+		mm_game_put(games[i]);
+		mm_game_try_reclaim(games[i]);
+	}
+	spin_unlock(&room->table_lock);
+	rcu_barrier();
+}
+
+/*
+ * allocate n uid games for the benchmarks in the test room, started at
+ * the default shape
+ */
+static struct mm_game **mm_kunit_make_games(struct kunit *test, unsigned n)
+{
+	struct mm_room *room = mm_kunit_room(test);
+	struct mm_game **games;
+	unsigned i;
+
+	games = kunit_kzalloc(test, n * sizeof(*games), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, games);
+	for (i = 0; i < n; i++) {
+		games[i] = mm_find_game(room, mm_kunit_uid(i));
+		if (!games[i]) {
+			mm_kunit_drop_games(room, games, i);
+			KUNIT_FAIL(test, "could not allocate game %u", i);
+			return NULL;
+		}
+		spin_lock(&games[i]->lock);
+		mm_game_start(games[i], NUM_PEGS, NUM_COLORS);
+		spin_unlock(&games[i]->lock);
+	}
+	return games;
+}
+
+/**
+ * mm_kunit_start_target() - check the targets mm_game_start() picks
+ * @test: the test
+ *
+ * Games of NUM_PEGS pegs keep the code 4211 only if it is valid for
+ * their colors; with 4 colors or fewer every peg must be below colors.
+ */
+static void mm_kunit_start_target(struct kunit *test)
+{
+	static const unsigned shapes[][2] = {
+		{ NUM_PEGS, NUM_COLORS }, { NUM_PEGS, 5 }, { NUM_PEGS, 4 },
+		{ NUM_PEGS, 3 }, { NUM_PEGS, 2 }, { 6, 4 },
+	};
+	struct mm_game *game;
+	unsigned s;
+	unsigned i;
+	unsigned k;
+
+	game = mm_game_alloc(mm_kunit_room(test), mm_kunit_uid(0));
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, game);
+	game->is_private = true;
+
+	for (s = 0; s < ARRAY_SIZE(shapes); s++) {
+		for (i = 0; i < 100; i++) {
+			spin_lock(&game->lock);
+			mm_game_start(game, shapes[s][0], shapes[s][1]);
+			spin_unlock(&game->lock);
+			if (shapes[s][0] == NUM_PEGS && shapes[s][1] > 4)
+				KUNIT_EXPECT_EQ(test, game->target, 0x4211ULL);
+			for (k = 0; k < shapes[s][0]; k++)
+				KUNIT_EXPECT_LT_MSG(test,
+						    (game->target >> (4 * k)) & 0xf,
+						    (u64)shapes[s][1],
+						    "%ux%u target %llx",
+						    shapes[s][0], shapes[s][1],
+						    game->target);
+			KUNIT_EXPECT_EQ(test, game->target >> (4 * shapes[s][0]),
+					0ULL);
+		}
+	}
+
+	spin_lock(&game->lock);
+	mm_game_quit(game);
+	spin_unlock(&game->lock);
+	mm_game_put(game);
+	rcu_barrier();
+}
+
+static void mm_kunit_find_game(struct kunit *test)
+{
+	struct mm_game *games[3];
+	struct mm_game *again;
+	struct mm_room *room = mm_kunit_room(test);
+
+	games[0] = mm_find_game(room, mm_kunit_uid(0));
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, games[0]);
+	games[1] = mm_find_game(room, mm_kunit_uid(1));
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, games[1]);
+	games[2] = mm_find_game(room, mm_kunit_uid(1 << MM_HASH_BITS));
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, games[2]);
+
+	KUNIT_EXPECT_PTR_NE(test, games[0], games[1]);
+	KUNIT_EXPECT_PTR_NE(test, games[0], games[2]);
+	KUNIT_EXPECT_TRUE(test, uid_eq(games[2]->k_id,
+				       mm_kunit_uid(1 << MM_HASH_BITS)));
+	KUNIT_EXPECT_FALSE(test, games[0]->is_private);
+	KUNIT_EXPECT_PTR_EQ(test, games[0]->room, room);
+
+	/*the same uid finds the same game, with another reference */
+	again = mm_find_game(room, mm_kunit_uid(0));
+	KUNIT_EXPECT_PTR_EQ(test, again, games[0]);
+	KUNIT_EXPECT_EQ(test, kref_read(&games[0]->ref), 3);
+	mm_game_put(again);
+
+	/*mm_lookup_game() finds it too, but never creates one */
+	again = mm_lookup_game(room, mm_kunit_uid(1));
+	KUNIT_EXPECT_PTR_EQ(test, again, games[1]);
+	if (again)
+		mm_game_put(again);
+	KUNIT_EXPECT_PTR_EQ(test, mm_lookup_game(room, mm_kunit_uid(2)), NULL);
+
+	mm_kunit_drop_games(room, games, ARRAY_SIZE(games));
+	KUNIT_EXPECT_PTR_EQ(test, mm_lookup_game(room, mm_kunit_uid(0)), NULL);
+}
+
+static void mm_kunit_bench_score(struct kunit *test)
+{
+	u64 state = 0x2545f4914f6cdd1dULL;
+	u64 codes[256];
+	unsigned black;
+	unsigned white;
+	unsigned sum = 0;
+	u64 start;
+	u64 ns;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(codes); i++)
+		codes[i] = mm_kunit_code(mm_kunit_rand(&state) % 1296,
+					 NUM_PEGS, NUM_COLORS);
+	start = ktime_get_ns();
+	for (i = 0; i < 1000000; i++) {
+		mm_num_pegs(codes[i % 256], codes[(i / 256 + i) % 256],
+			    NUM_PEGS, &black, &white);
+		sum += black + white;
+	}
+	ns = ktime_get_ns() - start;
+	kunit_info(test, "mm_num_pegs: %llu ns per score (checksum %u)\n",
+		   div_u64(ns, 1000), sum);
+}
+
+static void mm_kunit_bench_lookup(struct kunit *test)
+{
+	struct mm_game **games = mm_kunit_make_games(test, MM_KUNIT_GAMES);
+	struct mm_room *room = mm_kunit_room(test);
+	struct mm_game *game;
+	u64 start;
+	u64 ns;
+	unsigned i;
+
+	if (!games)
+		return;
+	start = ktime_get_ns();
+	for (i = 0; i < 10 * MM_KUNIT_GAMES; i++) {
+		game = mm_lookup_game(room,
+				      mm_kunit_uid((i * 7919) % MM_KUNIT_GAMES));
+		/*an assertion would leave the games behind, so stop instead */
+		KUNIT_EXPECT_NOT_ERR_OR_NULL(test, game);
+		if (!game)
+			break;
+		mm_game_put(game);
+	}
+	ns = ktime_get_ns() - start;
+	if (i == 10 * MM_KUNIT_GAMES)
+		kunit_info(test, "mm_lookup_game: %llu ns per lookup among "
+			   "%u games\n", div_u64(ns, 10 * MM_KUNIT_GAMES),
+			   MM_KUNIT_GAMES);
+	mm_kunit_drop_games(room, games, MM_KUNIT_GAMES);
+}
+
+static void mm_kunit_bench_broadcast(struct kunit *test)
+{
+	struct mm_game **games = mm_kunit_make_games(test, MM_KUNIT_GAMES);
+	struct mm_room *room = mm_kunit_room(test);
+	u64 start;
+	u64 publish_ns;
+	u64 sync_ns;
+	unsigned i;
+
+	if (!games)
+		return;
+	start = ktime_get_ns();
+	mm_code_publish(room, 0x2345, 6);
+	publish_ns = ktime_get_ns() - start;
+
+	/*every game picks the code up the next time it is played */
+	start = ktime_get_ns();
+	for (i = 0; i < MM_KUNIT_GAMES; i++) {
+		spin_lock(&games[i]->lock);
+		mm_game_sync_code(games[i]);
+		spin_unlock(&games[i]->lock);
+	}
+	sync_ns = ktime_get_ns() - start;
+	for (i = 0; i < MM_KUNIT_GAMES; i++)
+		KUNIT_EXPECT_EQ(test, games[i]->target, 0x2345ULL);
+
+	kunit_info(test, "mm_code_publish: %llu ns, then %llu ns per game "
+		   "to sync, over %u games\n", publish_ns,
+		   div_u64(sync_ns, MM_KUNIT_GAMES), MM_KUNIT_GAMES);
+
+	mm_kunit_drop_games(room, games, MM_KUNIT_GAMES);
+}
+
+static struct kunit_case mm_kunit_cases[] = {
+	KUNIT_CASE(mm_kunit_num_pegs_default),
+	KUNIT_CASE(mm_kunit_num_pegs_shapes),
+	KUNIT_CASE(mm_kunit_num_pegs_random),
+	KUNIT_CASE(mm_kunit_ctl_parse),
+	KUNIT_CASE(mm_kunit_packet_code),
+	KUNIT_CASE(mm_kunit_start_target),
+	KUNIT_CASE(mm_kunit_find_game),
+	{}
+};
+
+static struct kunit_suite mm_kunit_suite = {
+	.name = "mastermind2",
+	.init = mm_kunit_init,
+	.exit = mm_kunit_exit,
+	.test_cases = mm_kunit_cases,
+};
+
+static struct kunit_case mm_kunit_bench_cases[] = {
+	KUNIT_CASE(mm_kunit_bench_score),
+	KUNIT_CASE(mm_kunit_bench_lookup),
+	KUNIT_CASE(mm_kunit_bench_broadcast),
+	{}
+};
+
+static struct kunit_suite mm_kunit_bench_suite = {
+	.name = "mastermind2_bench",
+	.init = mm_kunit_init,
+	.exit = mm_kunit_exit,
+	.test_cases = mm_kunit_bench_cases,
+};
+
+kunit_test_suites(&mm_kunit_suite, &mm_kunit_bench_suite);
@@ -0,0 +1,75 @@
+/**
+ * Scoring rules of the mastermind2 driver, shared by the kernel module
+ * and the userspace tools so that the two can never disagree.
+ *
+ * Codes are packed one peg per nibble of a 64-bit integer, with the
+ * first peg in the highest nibble used. A code of 4 pegs 4, 2, 1, 1 is
+ * 0x4211.
+ */
+
+#ifndef MASTERMIND2_SCORE_H
+#define MASTERMIND2_SCORE_H
+
+#include <linux/types.h>
+
+#ifdef __KERNEL__
+#include <linux/bitops.h>
+#define mm_popcount64(x) hweight64(x)
+#else
+#define mm_popcount64(x) __builtin_popcountll(x)
+#endif
+
+/* largest games: one nibble per peg in a u64, one color per nibble value */
+#define MM_MAX_PEGS 16
+#define MM_MAX_COLORS 16
+
+/*
+ * a score packs the black and white peg counts of a guess; either can
+ * be as large as MM_MAX_PEGS
+ */
+#define MM_SCORE(black, white) ((black) << 8 | (white))
+#define MM_SCORE_BLACK(score) ((score) >> 8)
+#define MM_SCORE_WHITE(score) ((score) & 0xff)
+
+/**
+ * mm_num_pegs() - calculate number of black pegs and number of white pegs
+ * @target: target code, one peg per nibble, first peg in the highest
+ * nibble used
+ * @guess: user's guess, packed like @target
+ * @pegs: pegs in both codes, up to MM_MAX_PEGS
+ * @num_black: *OUT* parameter, to store calculated number of black pegs
+ * @num_white: *OUT* parameter, to store calculated number of white pegs
+ *
+ * Black pegs are the nibbles in which the codes agree, found all at
+ * once from their XOR. Every color contributes the smaller of its
+ * counts in the two codes to black plus white, so one histogram pass
+ * replaces comparing every peg against every other.
+ */
+static inline void mm_num_pegs(__u64 target, __u64 guess, unsigned pegs,
+			       unsigned *num_black, unsigned *num_white)
+{
+	__u8 target_colors[MM_MAX_COLORS] = { 0 };
+	__u8 guess_colors[MM_MAX_COLORS] = { 0 };
+	__u64 diff = target ^ guess;
+	unsigned common = 0;
+	unsigned i;
+
+	/*fold each nibble of diff into its low bit: set if the pegs differ */
+	diff |= diff >> 2;
+	diff |= diff >> 1;
+	diff &= 0x1111111111111111ULL;
+	if (pegs < MM_MAX_PEGS)
+		diff &= (1ULL << (4 * pegs)) - 1;
+	*num_black = pegs - mm_popcount64(diff);
+
+	for (i = 0; i < pegs; i++) {
+		target_colors[(target >> (4 * i)) & 0xf]++;
+		guess_colors[(guess >> (4 * i)) & 0xf]++;
+	}
+	for (i = 0; i < MM_MAX_COLORS; i++)
+		common += target_colors[i] < guess_colors[i] ?
+		    target_colors[i] : guess_colors[i];
+	*num_white = common - *num_black;
+}
+
+#endif
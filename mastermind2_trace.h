@@ -0,0 +1,126 @@
+/**
+ * Tracepoints of the mastermind2 module.
+ *
+ * Enable them with, for example,
+ *   trace-cmd record -e mastermind2
+ * or
+ *   perf record -e 'mastermind2:*'
+ *
+ * Games are identified by their owner's uid, plus the address of the
+ * game (hashed by %p) so private games of the same uid can be told
+ * apart.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mastermind2
+
+#if !defined(_MASTERMIND2_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MASTERMIND2_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* fields shared by the events of one game */
+DECLARE_EVENT_CLASS(mm_game_class,
+
+	TP_PROTO(const void *game, kuid_t uid, unsigned num_guesses),
+
+	TP_ARGS(game, uid, num_guesses),
+
+	TP_STRUCT__entry(
+		__field(const void *, game)
+		__field(uid_t, uid)
+		__field(unsigned, num_guesses)
+	),
+
+	TP_fast_assign(
+		__entry->game = game;
+		__entry->uid = from_kuid(&init_user_ns, uid);
+		__entry->num_guesses = num_guesses;
+	),
+
+	TP_printk("game=%p uid=%u guesses=%u", __entry->game, __entry->uid,
+		  __entry->num_guesses)
+);
+
+/* a game was started or restarted */
+DEFINE_EVENT(mm_game_class, mm_game_start,
+	TP_PROTO(const void *game, kuid_t uid, unsigned num_guesses),
+	TP_ARGS(game, uid, num_guesses)
+);
+
+/* a guess matched the target code; mm_game_quit follows */
+DEFINE_EVENT(mm_game_class, mm_game_win,
+	TP_PROTO(const void *game, kuid_t uid, unsigned num_guesses),
+	TP_ARGS(game, uid, num_guesses)
+);
+
+/* a game in progress ended, whether it was won, quit, or closed */
+DEFINE_EVENT(mm_game_class, mm_game_quit,
+	TP_PROTO(const void *game, kuid_t uid, unsigned num_guesses),
+	TP_ARGS(game, uid, num_guesses)
+);
+
+/* a guess was scored; code holds one of its pegs per nibble */
+TRACE_EVENT(mm_guess,
+
+	TP_PROTO(const void *game, kuid_t uid, unsigned num_guesses,
+		 unsigned pegs, u64 code, unsigned black, unsigned white),
+
+	TP_ARGS(game, uid, num_guesses, pegs, code, black, white),
+
+	TP_STRUCT__entry(
+		__field(const void *, game)
+		__field(uid_t, uid)
+		__field(unsigned, num_guesses)
+		__field(u64, code)
+		__field(u8, pegs)
+		__field(u8, black)
+		__field(u8, white)
+	),
+
+	TP_fast_assign(
+		__entry->game = game;
+		__entry->uid = from_kuid(&init_user_ns, uid);
+		__entry->num_guesses = num_guesses;
+		__entry->code = code;
+		__entry->pegs = pegs;
+		__entry->black = black;
+		__entry->white = white;
+	),
+
+	TP_printk("game=%p uid=%u guess=%u code=%0*llx B%uW%u",
+		  __entry->game, __entry->uid, __entry->num_guesses,
+		  __entry->pegs, __entry->code, __entry->black, __entry->white)
+);
+
+/* a new target code arrived over CS421Net for one room */
+TRACE_EVENT(mm_code_change,
+
+	TP_PROTO(unsigned room, u64 code, unsigned long gen),
+
+	TP_ARGS(room, code, gen),
+
+	TP_STRUCT__entry(
+		__field(unsigned, room)
+		__field(u64, code)
+		__field(unsigned long, gen)
+	),
+
+	TP_fast_assign(
+		__entry->room = room;
+		__entry->code = code;
+		__entry->gen = gen;
+	),
+
+	TP_printk("room=%u code=%04llx gen=%lu", __entry->room, __entry->code,
+		  __entry->gen)
+);
+
+#endif /* _MASTERMIND2_TRACE_H */
+
+/* the module is built out of tree, so look for this file next to it */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mastermind2_trace
+#include <trace/define_trace.h>
@@ -26,7 +26,9 @@
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/random.h>
+#include <linux/seqlock.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 
@@ -34,10 +36,21 @@
 #define NUM_COLORS 6
 #define USER_VIEW_SIZE 4096
 
+/*
+ * Concurrency: the game has a single writer at a time. mm_write() and
+ * mm_ctl_write() hold mm_lock for as long as they change the game, and
+ * publish @game_active, @last_result and @num_guesses under the write
+ * side of mm_state_lock. mm_read() only takes the read side, so any
+ * number of readers poll the game without ever waiting on a lock; a
+ * reader that overlapped a write simply retries.
+ */
+static DEFINE_MUTEX(mm_lock);
+static DEFINE_SEQLOCK(mm_state_lock);
+
 /** true if user is in the middle of a game */
 static bool game_active;
 
-/** code that player is trying to guess */
+/** code that player is trying to guess, protected by mm_lock */
 static int target_code[NUM_PEGS];
 
 /** tracks number of guesses user has made */
@@ -46,12 +59,20 @@ static unsigned num_guesses;
 /** result of most recent user guess */
 static char last_result[4];
 
-/** buffer that records all of user's guesses and their results */
+/** buffer that records all of user's guesses and their results,
+ * protected by mm_lock */
 static char *user_view;
 
+/** all-zero buffer that replaces @user_view when a game starts,
+ * protected by mm_lock */
+static char *user_view_spare;
+
 /** use_view offset for the current placement of last_result*/
 static size_t uv_off;
 
+/** mappings of @user_view; while there are any, it must stay in place */
+static atomic_t uv_maps = ATOMIC_INIT(0);
+
 //prototypes
 static ssize_t mm_read(struct file *filp, char __user * ubuf, size_t count,
 		       loff_t * ppos);
@@ -147,23 +168,35 @@ static void mm_num_pegs(int target[], int guess[], unsigned *num_black,
  * If no game is active, instead copy to @ubuf up to four '?'
  * characters.
  *
+ * The result is snapshotted under the read side of mm_state_lock and
+ * copied to user space afterwards, so readers never block the writer
+ * nor each other.
+ *
  * Return: number of bytes written to @ubuf, or negative on error
  */
 static ssize_t mm_read(struct file *filp, char __user * ubuf, size_t count,
 		       loff_t * ppos)
 {
 	size_t num_bytes = count;
-	char *q = "????";
+	char result[4];
+	unsigned seq;
+	bool active;
 
 	if (*ppos > 0)
 		return 0;
 
-	if (game_active) {
+	do {
+		seq = read_seqbegin(&mm_state_lock);
+		active = game_active;
+		memcpy(result, last_result, sizeof(result));
+	} while (read_seqretry(&mm_state_lock, seq));
+
+	if (active) {
 		if (NUM_PEGS > *ppos) {
 
 			if (NUM_PEGS - *ppos < count)
 				num_bytes = NUM_PEGS - *ppos;
-			if (copy_to_user(ubuf + *ppos, last_result, num_bytes)
+			if (copy_to_user(ubuf + *ppos, result, num_bytes)
 			    != 0)
 				return 0;
 			*ppos += num_bytes;
@@ -172,7 +205,7 @@ static ssize_t mm_read(struct file *filp, char __user * ubuf, size_t count,
 		return 0;
 	} else {
 
-		if (copy_to_user(ubuf + *ppos, q, NUM_PEGS) != 0) {
+		if (copy_to_user(ubuf + *ppos, "????", NUM_PEGS) != 0) {
 			return 0;
 		}
 		*ppos += NUM_PEGS;
@@ -195,6 +228,8 @@ static ssize_t mm_read(struct file *filp, char __user * ubuf, size_t count,
  * and how many are simply the correct value. Then update
  * @num_guesses, @last_result, and @user_view.
  *
+ * Guesses are scored one at a time under mm_lock.
+ *
  * <em>Caution: @ubuf is NOT a string; it is not necessarily
  * null-terminated.</em> You CANNOT use strcpy() or strlen() on it!
  *
@@ -209,35 +244,82 @@ static ssize_t mm_write(struct file *filp, const char __user * ubuf,
 	unsigned black;
 	unsigned white;
 
-	if (game_active && count >= NUM_PEGS) {
-		if (copy_from_user(guess, ubuf, NUM_PEGS) != 0)
-			return -1;
+	if (count < NUM_PEGS)
+		return -EINVAL;
+	if (copy_from_user(guess, ubuf, NUM_PEGS) != 0)
+		return -1;
 
-		for (i = 0; i < NUM_PEGS; i++) {
-			g[i] = guess[i] - '0';
-		}
+	for (i = 0; i < NUM_PEGS; i++) {
+		g[i] = guess[i] - '0';
+	}
 
-		/*get number of black and white pegs */
-		mm_num_pegs(target_code, g, &black, &white);
+	mutex_lock(&mm_lock);
+	if (!game_active) {
+		mutex_unlock(&mm_lock);
+		return -EINVAL;
+	}
 
-		/*update last result */
-		last_result[1] = black + '0';
-		last_result[3] = white + '0';
+	/*get number of black and white pegs */
+	mm_num_pegs(target_code, g, &black, &white);
+
+	/*update last result and num guesses */
+	write_seqlock(&mm_state_lock);
+	last_result[1] = black + '0';
+	last_result[3] = white + '0';
+	num_guesses++;
+	write_sequnlock(&mm_state_lock);
+
+	/*update user_view */
+	uv_off +=
+	    scnprintf(user_view + uv_off, USER_VIEW_SIZE - uv_off,
+		      "Guess %d: %d%d%d%d | %c%c%c%c\n", num_guesses,
+		      g[0], g[1], g[2], g[3], last_result[0],
+		      last_result[1], last_result[2], last_result[3]);
+	pr_info("%s\n", user_view);
+	mutex_unlock(&mm_lock);
 
-		/*updates num guesses */
-		num_guesses++;
+	return count;
+}
 
-		/*update user_view */
-		uv_off +=
-		    scnprintf(user_view + uv_off, PAGE_SIZE,
-			      "Guess %d: %d%d%d%d | %c%c%c%c\n", num_guesses,
-			      g[0], g[1], g[2], g[3], last_result[0],
-			      last_result[1], last_result[2], last_result[3]);
-		pr_info("%s\n", user_view);
+/* a mapping of @user_view was copied by fork() or split */
+static void mm_view_vm_open(struct vm_area_struct *vma)
+{
+	atomic_inc(&uv_maps);
+}
 
-		return count;
-	} else
-		return -EINVAL;
+/* a mapping of @user_view went away */
+static void mm_view_vm_close(struct vm_area_struct *vma)
+{
+	atomic_dec(&uv_maps);
+}
+
+static const struct vm_operations_struct mm_view_vm_ops = {
+	.open = mm_view_vm_open,
+	.close = mm_view_vm_close,
+};
+
+/**
+ * mm_view_reset() - give a new game an empty @user_view
+ *
+ * Swap in @user_view_spare, which is kept all zero, and zero the
+ * previous buffer for the next game, only as far as it was written.
+ * If @user_view is mapped, it is cleared in place instead, so that the
+ * mapping keeps showing the current game.
+ *
+ * Must be called with mm_lock held.
+ */
+static void mm_view_reset(void)
+{
+	char *old = user_view;
+
+	if (atomic_read(&uv_maps)) {
+		memset(user_view, 0, uv_off);
+	} else {
+		user_view = user_view_spare;
+		user_view_spare = old;
+		memset(user_view_spare, 0, uv_off);
+	}
+	uv_off = 0;
 }
 
 /**
@@ -251,22 +333,33 @@ static ssize_t mm_write(struct file *filp, const char __user * ubuf,
  * Code based upon
  * <a href="http://bloggar.combitech.se/ldc/2015/01/21/mmap-memory-between-kernel-and-userspace/">http://bloggar.combitech.se/ldc/2015/01/21/mmap-memory-between-kernel-and-userspace/</a>
  *
- * You do not need to modify this function.
+ * While the mapping exists, @user_view is counted in @uv_maps so that
+ * starting a game clears it in place instead of swapping it out from
+ * under the mapping.
  *
  * Return: 0 on success, negative on error.
  */
 static int mm_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	unsigned long size = (unsigned long)(vma->vm_end - vma->vm_start);
-	unsigned long page = vmalloc_to_pfn(user_view);
+	unsigned long page;
+	int err = 0;
+
 	if (size > PAGE_SIZE)
 		return -EIO;
+	mutex_lock(&mm_lock);
+	page = vmalloc_to_pfn(user_view);
 	vma->vm_pgoff = 0;
 	vma->vm_page_prot = PAGE_READONLY;
 	if (remap_pfn_range(vma, vma->vm_start, page, size, vma->vm_page_prot))
-		return -EAGAIN;
+		err = -EAGAIN;
+	if (!err) {
+		vma->vm_ops = &mm_view_vm_ops;
+		atomic_inc(&uv_maps);
+	}
+	mutex_unlock(&mm_lock);
 
-	return 0;
+	return err;
 }
 
 /**
@@ -286,6 +379,8 @@ static int mm_mmap(struct file *filp, struct vm_area_struct *vma)
  *
  * If the input is neither of the above, then return -EINVAL.
  *
+ * The game is changed under mm_lock, so it never races a guess.
+ *
  * <em>Caution: @ubuf is NOT a string;</em> it is not necessarily
  * null-terminated, nor does it necessarily have a trailing
  * newline. You CANNOT use strcpy() or strlen() on it!
@@ -336,6 +431,7 @@ static ssize_t mm_ctl_write(struct file *filp, const char __user * ubuf,
 	} else
 		return -EINVAL;
 
+	mutex_lock(&mm_lock);
 	/*if the input was start */
 	if (start) {
 		target_code[0] = 4;
@@ -343,20 +439,23 @@ static ssize_t mm_ctl_write(struct file *filp, const char __user * ubuf,
 		target_code[2] = 1;
 		target_code[3] = 1;
 
+		/*also resets userview byte offset */
+		mm_view_reset();
+
+		write_seqlock(&mm_state_lock);
 		num_guesses = 0;
-		for (i = 0; i < USER_VIEW_SIZE; i++)
-			user_view[i] = '\0';
 		game_active = true;
 		last_result[0] = 'B';
 		last_result[1] = '-';
 		last_result[2] = 'W';
 		last_result[3] = '-';
-
-		/*reset userview byte offset */
-		uv_off = 0;
+		write_sequnlock(&mm_state_lock);
 	} else {		/*if the input was quit */
+		write_seqlock(&mm_state_lock);
 		game_active = false;
+		write_sequnlock(&mm_state_lock);
 	}
+	mutex_unlock(&mm_lock);
 
 	return count;
 }
@@ -370,9 +469,12 @@ static int __init mastermind_init(void)
 	int err;
 
 	pr_info("Initializing the game.\n");
-	user_view = vmalloc(PAGE_SIZE);
-	if (!user_view) {
+	user_view = vzalloc(PAGE_SIZE);
+	user_view_spare = vzalloc(PAGE_SIZE);
+	if (!user_view || !user_view_spare) {
 		pr_err("Could not allocate memory\n");
+		vfree(user_view);
+		vfree(user_view_spare);
 		return -ENOMEM;
 	}
 
@@ -387,7 +489,9 @@ static int __init mastermind_init(void)
 
 	//failed registrations
 fail_mm_ctl:misc_deregister(&mm_device);
-fail_mm:return err;
+fail_mm:vfree(user_view);
+	vfree(user_view_spare);
+	return err;
 }
 
 /**
@@ -397,6 +501,7 @@ static void __exit mastermind_exit(void)
 {
 	pr_info("Freeing resources.\n");
 	vfree(user_view);
+	vfree(user_view_spare);
 
 	/* YOUR CODE HERE */
 	misc_deregister(&mm_device);	/*undo's the registration from init */
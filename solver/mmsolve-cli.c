@@ -0,0 +1,363 @@
+/**
+ * mmsolve - solve Mastermind games, give hints, and measure the solver
+ *
+ *   mmsolve [-p pegs] [-c colors] [-t threads] [-e] hint [GUESS=BxWy]...
+ *     print the best next guess, given the results so far
+ *   mmsolve [options] solve SECRET
+ *     print every guess it takes to find SECRET
+ *   mmsolve [options] play
+ *     win a private game of /dev/mm through its ioctl interface
+ *   mmsolve [options] bench [games]
+ *     solve about games secrets (default 500) of the chosen shape, or
+ *     of a series of shapes if -p and -c are not given, and report
+ *     solves per second
+ *
+ * Codes are hexadecimal, one digit per peg. -e ranks guesses by the
+ * expected number of candidates left instead of Knuth's worst case.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mastermind2.h"
+#include "mastermind2_score.h"
+#include "mmsolve.h"
+
+/* shapes benchmarked when none is given, as pegs and colors */
+static const unsigned bench_shapes[][2] = {
+	{4, 6}, {4, 8}, {5, 6},
+};
+
+static unsigned pegs = 4;
+static unsigned colors = 6;
+static unsigned threads;
+static enum mm_strategy strategy = MM_STRATEGY_MINIMAX;
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: mmsolve [-p pegs] [-c colors] [-t threads] "
+		"[-e] hint [GUESS=BxWy]... | solve SECRET | play | "
+		"bench [games]\n");
+	exit(2);
+}
+
+/* parse a hexadecimal code of the current shape into its index */
+static long parse_code(const struct mm_solver *solver, const char *text)
+{
+	char *end;
+	unsigned long long code;
+
+	if (strlen(text) != pegs)
+		return -1;
+	code = strtoull(text, &end, 16);
+	if (*end != '\0')
+		return -1;
+	return mm_solver_index(solver, code);
+}
+
+static void print_code(const struct mm_solver *solver, unsigned index)
+{
+	printf("%0*llx", (int)pegs,
+	       (unsigned long long)mm_solver_code(solver, index));
+}
+
+static int hint(const struct mm_solver *solver, int argc, char *argv[])
+{
+	struct mm_solver_game game;
+	unsigned black;
+	unsigned white;
+	char *eq;
+	long guess;
+	int i;
+
+	if (mm_solver_game_init(&game, solver) != 0) {
+		perror("mmsolve");
+		return 1;
+	}
+	for (i = 0; i < argc; i++) {
+		eq = strchr(argv[i], '=');
+		if (!eq || sscanf(eq + 1, "B%uW%u", &black, &white) != 2)
+			usage();
+		*eq = '\0';
+		guess = parse_code(solver, argv[i]);
+		if (guess < 0 || black + white > pegs)
+			usage();
+		if (mm_solver_feed(&game, guess, MM_SCORE(black, white)) == 0) {
+			printf("No code matches these results\n");
+			mm_solver_game_free(&game);
+			return 1;
+		}
+	}
+	print_code(solver, mm_solver_next(&game, strategy));
+	printf(" (%u candidates left)\n", game.ncand);
+	mm_solver_game_free(&game);
+	return 0;
+}
+
+static int solve(const struct mm_solver *solver, const char *text)
+{
+	struct mm_solver_game game;
+	long secret = parse_code(solver, text);
+	unsigned guess;
+	unsigned score;
+
+	if (secret < 0)
+		usage();
+	if (mm_solver_game_init(&game, solver) != 0) {
+		perror("mmsolve");
+		return 1;
+	}
+	do {
+		guess = mm_solver_next(&game, strategy);
+		score = mm_solver_score(solver, secret, guess);
+		mm_solver_feed(&game, guess, score);
+		printf("Guess %u: ", game.guesses);
+		print_code(solver, guess);
+		printf(" | B%uW%u\n", MM_SCORE_BLACK(score),
+		       MM_SCORE_WHITE(score));
+	} while (MM_SCORE_BLACK(score) != pegs);
+	mm_solver_game_free(&game);
+	return 0;
+}
+
+static int play(const struct mm_solver *solver)
+{
+	struct mm_solver_game game;
+	struct mm_ioc_start start = { 0 };
+	struct mm_ioc_guess req;
+	unsigned guess;
+	unsigned k;
+	__u64 code;
+	int ret = 0;
+	int fd;
+
+	fd = open("/dev/mm", O_RDWR);
+	start.pegs = pegs;
+	start.colors = colors;
+	if (fd == -1 || ioctl(fd, MM_IOC_PRIVATE) == -1 ||
+	    ioctl(fd, MM_IOC_START, &start) == -1) {
+		perror("/dev/mm");
+		return 1;
+	}
+	if (mm_solver_game_init(&game, solver) != 0) {
+		perror("mmsolve");
+		close(fd);
+		return 1;
+	}
+	do {
+		guess = mm_solver_next(&game, strategy);
+		code = mm_solver_code(solver, guess);
+		memset(&req, 0, sizeof(req));
+		for (k = 0; k < pegs; k++)
+			req.pegs[k] = (code >> (4 * (pegs - 1 - k))) & 0xf;
+		if (ioctl(fd, MM_IOC_GUESS, &req) == -1) {
+			perror("MM_IOC_GUESS");
+			ret = 1;
+			break;
+		}
+		printf("Guess %u: ", req.num_guesses);
+		print_code(solver, guess);
+		printf(" | B%uW%u\n", req.black, req.white);
+		if (mm_solver_feed(&game, guess,
+				   MM_SCORE(req.black, req.white)) == 0) {
+			/*the code was changed over CS421Net; start over */
+			mm_solver_game_free(&game);
+			if (mm_solver_game_init(&game, solver) != 0) {
+				perror("mmsolve");
+				ret = 1;
+				break;
+			}
+		}
+	} while (req.active);
+	mm_solver_game_free(&game);
+	close(fd);
+	return ret;
+}
+
+struct bench_work {
+	const struct mm_solver *solver;
+	unsigned lo;
+	unsigned hi;
+	unsigned step;
+	unsigned long long guesses;
+	unsigned worst;
+	int failed;
+};
+
+/* solve the secrets lo, lo + step, ... below hi */
+static void *bench_thread(void *arg)
+{
+	struct bench_work *w = arg;
+	unsigned secret;
+	int n;
+
+	for (secret = w->lo; secret < w->hi; secret += w->step) {
+		n = mm_solver_solve(w->solver, secret, strategy, 0);
+		if (n < 0) {
+			w->failed = 1;
+			return NULL;
+		}
+		w->guesses += n;
+		if ((unsigned)n > w->worst)
+			w->worst = n;
+	}
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* benchmark one shape, solving games secrets spread over its codes */
+static int bench_shape(unsigned p, unsigned c, unsigned games)
+{
+	struct mm_solver *solver;
+	struct bench_work *work;
+	pthread_t *tids;
+	char *started;
+	unsigned long long guesses = 0;
+	unsigned worst = 0;
+	unsigned ncodes;
+	unsigned step;
+	unsigned n;
+	unsigned solved;
+	unsigned i;
+	double setup;
+	double t0;
+	double elapsed;
+	int failed = 0;
+
+	t0 = now();
+	solver = mm_solver_new(p, c, threads);
+	if (!solver) {
+		perror("mm_solver_new");
+		return 1;
+	}
+	ncodes = mm_solver_ncodes(solver);
+	step = ncodes > games ? ncodes / games : 1;
+	solved = (ncodes + step - 1) / step;
+
+	/*the first guess is shared by every game, so find it up front */
+	mm_solver_solve(solver, 0, strategy, 1);
+	setup = now() - t0;
+
+	n = threads ? threads : sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1)
+		n = 1;
+	work = calloc(n, sizeof(*work));
+	tids = calloc(n, sizeof(*tids));
+	started = calloc(n, 1);
+	if (!work || !tids || !started) {
+		perror("mmsolve");
+		return 1;
+	}
+	/*thread i solves every n-th of the sampled secrets */
+	for (i = 0; i < n; i++) {
+		work[i].solver = solver;
+		work[i].lo = i * step;
+		work[i].hi = ncodes;
+		work[i].step = n * step;
+	}
+	t0 = now();
+	for (i = 0; i < n; i++)
+		started[i] = pthread_create(&tids[i], NULL, bench_thread,
+					    &work[i]) == 0;
+	for (i = 0; i < n; i++) {
+		if (started[i])
+			pthread_join(tids[i], NULL);
+		else
+			bench_thread(&work[i]);
+	}
+	elapsed = now() - t0;
+	for (i = 0; i < n; i++) {
+		guesses += work[i].guesses;
+		if (work[i].worst > worst)
+			worst = work[i].worst;
+		failed |= work[i].failed;
+	}
+
+	printf("%u pegs %2u colors: %8u codes, setup %.3f s, %u games in "
+	       "%.3f s, %.1f solves/s, %.3f guesses avg, %u max\n", p, c,
+	       ncodes, setup, solved, elapsed, solved / elapsed,
+	       (double)guesses / solved, worst);
+	free(started);
+	free(tids);
+	free(work);
+	mm_solver_free(solver);
+	return failed;
+}
+
+int main(int argc, char *argv[])
+{
+	struct mm_solver *solver;
+	int shape_given = 0;
+	unsigned games = 500;
+	unsigned i;
+	int opt;
+	int ret;
+
+	while ((opt = getopt(argc, argv, "p:c:t:e")) != -1) {
+		switch (opt) {
+		case 'p':
+			pegs = atoi(optarg);
+			shape_given = 1;
+			break;
+		case 'c':
+			colors = atoi(optarg);
+			shape_given = 1;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'e':
+			strategy = MM_STRATEGY_EXPECTED;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind >= argc)
+		usage();
+
+	if (strcmp(argv[optind], "bench") == 0) {
+		if (optind + 1 < argc)
+			games = atoi(argv[optind + 1]);
+		if (games == 0)
+			usage();
+		if (shape_given)
+			return bench_shape(pegs, colors, games);
+		ret = 0;
+		for (i = 0; i < sizeof(bench_shapes) / sizeof(bench_shapes[0]);
+		     i++)
+			ret |= bench_shape(bench_shapes[i][0],
+					   bench_shapes[i][1], games);
+		return ret;
+	}
+
+	solver = mm_solver_new(pegs, colors, threads);
+	if (!solver) {
+		perror("mm_solver_new");
+		return 1;
+	}
+	if (strcmp(argv[optind], "hint") == 0)
+		ret = hint(solver, argc - optind - 1, argv + optind + 1);
+	else if (strcmp(argv[optind], "solve") == 0 && optind + 2 == argc)
+		ret = solve(solver, argv[optind + 1]);
+	else if (strcmp(argv[optind], "play") == 0)
+		ret = play(solver);
+	else
+		usage();
+	mm_solver_free(solver);
+	return ret;
+}
@@ -0,0 +1,482 @@
+/**
+ * Mastermind solver library, see mmsolve.h.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mastermind2_score.h"
+#include "mmsolve.h"
+
+/* largest shape mm_solver_new() accepts, in codes */
+#define MM_SOLVER_CODES_MAX (1U << 24)
+
+/* most threads a solver spreads work over */
+#define MM_SOLVER_THREADS_MAX 256
+
+struct mm_solver {
+	unsigned pegs;
+	unsigned colors;
+	unsigned ncodes;
+	unsigned threads;
+	/* distinct scores: black and white both range over 0..pegs */
+	unsigned nscores;
+	/* code of each index, in increasing order */
+	__u64 *codes;
+	/* dense score of guess g against target t at [t * ncodes + g], or
+	 * NULL for shapes of more than MM_SOLVER_MATRIX_MAX codes */
+	__u16 *matrix;
+	/* protects @first */
+	pthread_mutex_t first_lock;
+	/* cached first guess of each strategy, or -1 */
+	long first[2];
+};
+
+/* index of a score among the solver's nscores */
+static unsigned dense(const struct mm_solver *solver, unsigned black,
+		      unsigned white)
+{
+	return black * (solver->pegs + 1) + white;
+}
+
+/* dense score of @guess against @target, both code indexes */
+static unsigned dense_score(const struct mm_solver *solver, unsigned target,
+			    unsigned guess)
+{
+	unsigned black;
+	unsigned white;
+
+	if (solver->matrix)
+		return solver->matrix[(size_t)target * solver->ncodes + guess];
+	mm_num_pegs(solver->codes[target], solver->codes[guess], solver->pegs,
+		    &black, &white);
+	return dense(solver, black, white);
+}
+
+/**
+ * run_threads() - split a range of work over threads
+ * @fn: work function, called once per thread
+ * @args: one argument per thread, each @size bytes
+ * @size: size of an argument
+ * @n: number of threads, including the calling one
+ *
+ * The calling thread runs the first argument itself. If a thread cannot
+ * be created, the caller runs that argument as well.
+ */
+static void run_threads(void *(*fn)(void *), void *args, size_t size,
+			unsigned n)
+{
+	pthread_t tids[MM_SOLVER_THREADS_MAX];
+	bool started[MM_SOLVER_THREADS_MAX];
+	unsigned i;
+
+	for (i = 1; i < n; i++)
+		started[i] = pthread_create(&tids[i], NULL, fn,
+					    (char *)args + i * size) == 0;
+	fn(args);
+	for (i = 1; i < n; i++) {
+		if (started[i])
+			pthread_join(tids[i], NULL);
+		else
+			fn((char *)args + i * size);
+	}
+}
+
+struct fill_work {
+	struct mm_solver *solver;
+	unsigned lo;
+	unsigned hi;
+};
+
+/* fill rows lo to hi of the score matrix */
+static void *fill_rows(void *arg)
+{
+	struct fill_work *w = arg;
+	struct mm_solver *solver = w->solver;
+	unsigned black;
+	unsigned white;
+	unsigned t;
+	unsigned g;
+
+	for (t = w->lo; t < w->hi; t++) {
+		for (g = 0; g < solver->ncodes; g++) {
+			mm_num_pegs(solver->codes[t], solver->codes[g],
+				    solver->pegs, &black, &white);
+			solver->matrix[(size_t)t * solver->ncodes + g] =
+			    dense(solver, black, white);
+		}
+	}
+	return NULL;
+}
+
+struct mm_solver *mm_solver_new(unsigned pegs, unsigned colors,
+				unsigned threads)
+{
+	struct mm_solver *solver;
+	struct fill_work work[MM_SOLVER_THREADS_MAX];
+	unsigned long long ncodes = 1;
+	unsigned digits[MM_MAX_PEGS] = { 0 };
+	unsigned i;
+	unsigned k;
+
+	if (pegs < 1 || pegs > MM_MAX_PEGS || colors < 2 ||
+	    colors > MM_MAX_COLORS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	for (i = 0; i < pegs; i++) {
+		ncodes *= colors;
+		if (ncodes > MM_SOLVER_CODES_MAX) {
+			errno = ERANGE;
+			return NULL;
+		}
+	}
+	if (threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = online > 0 ? online : 1;
+	}
+	if (threads > MM_SOLVER_THREADS_MAX)
+		threads = MM_SOLVER_THREADS_MAX;
+
+	solver = calloc(1, sizeof(*solver));
+	if (!solver)
+		return NULL;
+	solver->pegs = pegs;
+	solver->colors = colors;
+	solver->ncodes = ncodes;
+	solver->threads = threads;
+	solver->nscores = (pegs + 1) * (pegs + 1);
+	solver->first[MM_STRATEGY_MINIMAX] = -1;
+	solver->first[MM_STRATEGY_EXPECTED] = -1;
+	pthread_mutex_init(&solver->first_lock, NULL);
+
+	solver->codes = malloc(ncodes * sizeof(*solver->codes));
+	if (!solver->codes)
+		goto fail;
+	/*count in base colors, most significant peg first */
+	for (i = 0; i < ncodes; i++) {
+		solver->codes[i] = 0;
+		for (k = 0; k < pegs; k++)
+			solver->codes[i] = solver->codes[i] << 4 | digits[k];
+		for (k = pegs; k-- > 0;) {
+			if (++digits[k] < colors)
+				break;
+			digits[k] = 0;
+		}
+	}
+
+	if (ncodes <= MM_SOLVER_MATRIX_MAX) {
+		solver->matrix = malloc(ncodes * ncodes *
+					sizeof(*solver->matrix));
+		if (!solver->matrix)
+			goto fail;
+		if (threads > ncodes)
+			threads = ncodes;
+		for (i = 0; i < threads; i++) {
+			work[i].solver = solver;
+			work[i].lo = ncodes * i / threads;
+			work[i].hi = ncodes * (i + 1) / threads;
+		}
+		run_threads(fill_rows, work, sizeof(work[0]), threads);
+	}
+	return solver;
+
+fail:
+	mm_solver_free(solver);
+	errno = ENOMEM;
+	return NULL;
+}
+
+void mm_solver_free(struct mm_solver *solver)
+{
+	if (!solver)
+		return;
+	pthread_mutex_destroy(&solver->first_lock);
+	free(solver->matrix);
+	free(solver->codes);
+	free(solver);
+}
+
+unsigned mm_solver_ncodes(const struct mm_solver *solver)
+{
+	return solver->ncodes;
+}
+
+__u64 mm_solver_code(const struct mm_solver *solver, unsigned i)
+{
+	return solver->codes[i];
+}
+
+long mm_solver_index(const struct mm_solver *solver, __u64 code)
+{
+	long index = 0;
+	unsigned peg;
+	unsigned k;
+
+	if (solver->pegs < MM_MAX_PEGS && code >> (4 * solver->pegs) != 0)
+		return -1;
+	for (k = solver->pegs; k-- > 0;) {
+		peg = (code >> (4 * k)) & 0xf;
+		if (peg >= solver->colors)
+			return -1;
+		index = index * solver->colors + peg;
+	}
+	return index;
+}
+
+unsigned mm_solver_score(const struct mm_solver *solver, unsigned target,
+			 unsigned guess)
+{
+	unsigned d = dense_score(solver, target, guess);
+
+	return MM_SCORE(d / (solver->pegs + 1), d % (solver->pegs + 1));
+}
+
+int mm_solver_game_init(struct mm_solver_game *game,
+			const struct mm_solver *solver)
+{
+	unsigned i;
+
+	game->solver = solver;
+	game->cand = malloc(solver->ncodes * sizeof(*game->cand));
+	if (!game->cand)
+		return -1;
+	for (i = 0; i < solver->ncodes; i++)
+		game->cand[i] = i;
+	game->ncand = solver->ncodes;
+	game->guesses = 0;
+	return 0;
+}
+
+void mm_solver_game_free(struct mm_solver_game *game)
+{
+	free(game->cand);
+	game->cand = NULL;
+}
+
+unsigned mm_solver_feed(struct mm_solver_game *game, unsigned guess,
+			unsigned score)
+{
+	const struct mm_solver *solver = game->solver;
+	unsigned want = dense(solver, MM_SCORE_BLACK(score),
+			      MM_SCORE_WHITE(score));
+	unsigned kept = 0;
+	unsigned i;
+
+	for (i = 0; i < game->ncand; i++)
+		if (dense_score(solver, game->cand[i], guess) == want)
+			game->cand[kept++] = game->cand[i];
+	game->ncand = kept;
+	game->guesses++;
+	return kept;
+}
+
+/* a guess and how well it splits the candidates */
+struct ranked {
+	unsigned long long key;
+	bool is_cand;
+	unsigned index;
+};
+
+/* true if @a is a better guess than @b */
+static bool better(const struct ranked *a, const struct ranked *b)
+{
+	if (a->key != b->key)
+		return a->key < b->key;
+	if (a->is_cand != b->is_cand)
+		return a->is_cand;
+	return a->index < b->index;
+}
+
+struct search_work {
+	const struct mm_solver_game *game;
+	enum mm_strategy strategy;
+	/* guesses to try: every pool_step-th of pool[lo] to pool[hi - 1],
+	 * or of lo to hi - 1 if pool is NULL */
+	const unsigned *pool;
+	unsigned lo;
+	unsigned hi;
+	unsigned pool_step;
+	/* every cand_step-th candidate is counted */
+	unsigned cand_step;
+	/* membership of every code index in game->cand */
+	const unsigned char *is_cand;
+	struct ranked best;
+};
+
+/* rank the guesses of one share of the pool */
+static void *search(void *arg)
+{
+	struct search_work *w = arg;
+	const struct mm_solver_game *game = w->game;
+	const struct mm_solver *solver = game->solver;
+	unsigned counts[(MM_MAX_PEGS + 1) * (MM_MAX_PEGS + 1)];
+	struct ranked r;
+	unsigned long long worst;
+	unsigned long long sumsq;
+	unsigned i;
+	unsigned j;
+	unsigned g;
+
+	w->best.key = ~0ULL;
+	w->best.is_cand = false;
+	w->best.index = ~0U;
+	for (i = w->lo; i < w->hi; i += w->pool_step) {
+		g = w->pool ? w->pool[i] : i;
+		memset(counts, 0, solver->nscores * sizeof(counts[0]));
+		for (j = 0; j < game->ncand; j += w->cand_step)
+			counts[dense_score(solver, game->cand[j], g)]++;
+		worst = 0;
+		sumsq = 0;
+		for (j = 0; j < solver->nscores; j++) {
+			if (counts[j] > worst)
+				worst = counts[j];
+			sumsq += (unsigned long long)counts[j] * counts[j];
+		}
+		r.key = w->strategy == MM_STRATEGY_MINIMAX ? worst : sumsq;
+		r.is_cand = w->is_cand[g];
+		r.index = g;
+		if (better(&r, &w->best))
+			w->best = r;
+	}
+	return NULL;
+}
+
+/**
+ * next_guess() - mm_solver_next() over a given number of threads
+ * @game: game to guess in
+ * @strategy: how to rank the guesses
+ * @threads: threads to spread the search over
+ *
+ * Return: index of the guess, or -1 if out of memory
+ */
+static long next_guess(const struct mm_solver_game *game,
+		       enum mm_strategy strategy, unsigned threads)
+{
+	const struct mm_solver *solver = game->solver;
+	struct search_work work[MM_SOLVER_THREADS_MAX];
+	unsigned char *is_cand;
+	const unsigned *pool;
+	unsigned npool;
+	unsigned pool_step = 1;
+	unsigned cand_step = 1;
+	unsigned long long tried;
+	unsigned i;
+	unsigned best;
+
+	/*with two candidates left, guessing either is as good as it gets */
+	if (game->ncand <= 2)
+		return game->cand[0];
+
+	is_cand = calloc(solver->ncodes, 1);
+	if (!is_cand)
+		return -1;
+	for (i = 0; i < game->ncand; i++)
+		is_cand[game->cand[i]] = 1;
+	if (solver->ncodes <= MM_SOLVER_FULL_POOL_MAX) {
+		pool = NULL;
+		npool = solver->ncodes;
+	} else {
+		pool = game->cand;
+		npool = game->ncand;
+	}
+
+	if ((unsigned long long)npool * game->ncand > MM_SOLVER_SEARCH_MAX) {
+		if (npool > MM_SOLVER_POOL_SAMPLE)
+			pool_step = npool / MM_SOLVER_POOL_SAMPLE;
+		tried = (npool + pool_step - 1) / pool_step;
+		cand_step = (tried * game->ncand + MM_SOLVER_SEARCH_MAX - 1) /
+		    MM_SOLVER_SEARCH_MAX;
+	}
+
+	/*split at multiples of pool_step so every thread samples alike */
+	npool /= pool_step;
+	if (threads > npool)
+		threads = npool;
+	for (i = 0; i < threads; i++) {
+		work[i].game = game;
+		work[i].strategy = strategy;
+		work[i].pool = pool;
+		work[i].lo = (unsigned long long)npool * i / threads * pool_step;
+		work[i].hi = (unsigned long long)npool * (i + 1) / threads *
+		    pool_step;
+		work[i].pool_step = pool_step;
+		work[i].cand_step = cand_step;
+		work[i].is_cand = is_cand;
+	}
+	run_threads(search, work, sizeof(work[0]), threads);
+
+	best = 0;
+	for (i = 1; i < threads; i++)
+		if (better(&work[i].best, &work[best].best))
+			best = i;
+	free(is_cand);
+	return work[best].best.index;
+}
+
+/*
+ * mm_solver_next() on @threads threads, with the first guess cached. The
+ * cache is the one part of a solver that changes after mm_solver_new(),
+ * so the const is cast away; @first_lock makes that safe to share.
+ */
+static long next_cached(const struct mm_solver_game *game,
+			enum mm_strategy strategy, unsigned threads)
+{
+	struct mm_solver *solver = (struct mm_solver *)game->solver;
+	long guess;
+
+	if (game->guesses > 0)
+		return next_guess(game, strategy, threads);
+
+	/*every game starts the same way, so only search for it once */
+	pthread_mutex_lock(&solver->first_lock);
+	guess = solver->first[strategy];
+	if (guess < 0) {
+		guess = next_guess(game, strategy, threads);
+		solver->first[strategy] = guess;
+	}
+	pthread_mutex_unlock(&solver->first_lock);
+	return guess;
+}
+
+unsigned mm_solver_next(struct mm_solver_game *game,
+			enum mm_strategy strategy)
+{
+	long guess = next_cached(game, strategy, game->solver->threads);
+
+	/*out of memory: any candidate still makes progress */
+	return guess < 0 ? game->cand[0] : guess;
+}
+
+int mm_solver_solve(const struct mm_solver *solver, unsigned secret,
+		    enum mm_strategy strategy, int threads_per_guess)
+{
+	struct mm_solver_game game;
+	unsigned threads = threads_per_guess ? solver->threads : 1;
+	unsigned score;
+	long guess;
+
+	if (mm_solver_game_init(&game, solver) != 0)
+		return -1;
+	for (;;) {
+		guess = next_cached(&game, strategy, threads);
+		if (guess < 0)
+			guess = game.cand[0];
+		score = mm_solver_score(solver, secret, guess);
+		if (mm_solver_feed(&game, guess, score) == 0 ||
+		    MM_SCORE_BLACK(score) == solver->pegs)
+			break;
+	}
+	mm_solver_game_free(&game);
+	if (MM_SCORE_BLACK(score) != solver->pegs) {
+		/*cannot happen while the scoring is consistent */
+		errno = EPROTO;
+		return -1;
+	}
+	return game.guesses;
+}
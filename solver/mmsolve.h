@@ -0,0 +1,169 @@
+/**
+ * Mastermind solver library for bots that play /dev/mm.
+ *
+ * Scores with mm_num_pegs() from mastermind2_score.h, the same code the
+ * driver uses, and packs codes the same way: one peg per nibble, first
+ * peg in the highest nibble used.
+ *
+ * A struct mm_solver describes one shape of game (pegs and colors). It
+ * is read-only once created except for a cache of each strategy's first
+ * guess, which mm_solver_next() fills in on first use under a mutex of
+ * the solver; so any number of threads can share it, even through a
+ * const pointer. A struct mm_solver_game tracks the codes still possible
+ * in one game; each thread playing a game needs its own.
+ *
+ * Build the mmsolve tool and libmmsolve.a with the Makefile alongside.
+ */
+
+#ifndef MMSOLVE_H
+#define MMSOLVE_H
+
+#include <linux/types.h>
+
+/* how mm_solver_next() ranks a guess by the candidates it leaves */
+enum mm_strategy {
+	/* Knuth: smallest worst-case number of candidates left */
+	MM_STRATEGY_MINIMAX,
+	/* smallest expected number of candidates left */
+	MM_STRATEGY_EXPECTED,
+};
+
+/*
+ * shapes with more codes than this score on the fly instead of from a
+ * precomputed matrix, which would take 2 * MM_SOLVER_MATRIX_MAX^2 bytes
+ */
+#define MM_SOLVER_MATRIX_MAX 4096
+
+/*
+ * shapes with more codes than this only consider the remaining
+ * candidates as guesses, rather than every code
+ */
+#define MM_SOLVER_FULL_POOL_MAX 8192
+
+/*
+ * most scores one mm_solver_next() computes. Beyond that, it ranks at
+ * most MM_SOLVER_POOL_SAMPLE guesses, and counts how each splits an
+ * evenly spaced sample of the candidates, so large shapes stay
+ * playable at the price of a guess or two.
+ */
+#define MM_SOLVER_SEARCH_MAX (1ULL << 26)
+#define MM_SOLVER_POOL_SAMPLE 4096
+
+struct mm_solver;
+
+/**
+ * struct mm_solver_game - codes still possible in one game
+ * @solver: shape of the game
+ * @cand: indexes of the codes that agree with every score fed so far
+ * @ncand: number of entries of @cand
+ * @guesses: guesses fed so far
+ */
+struct mm_solver_game {
+	const struct mm_solver *solver;
+	unsigned *cand;
+	unsigned ncand;
+	unsigned guesses;
+};
+
+/**
+ * mm_solver_new() - prepare to solve games of one shape
+ * @pegs: pegs per code, 1 to MM_MAX_PEGS
+ * @colors: colors per peg, 2 to MM_MAX_COLORS
+ * @threads: threads mm_solver_next() spreads its search over, 0 for
+ * one per online CPU
+ *
+ * Enumerates every code, and fills in the score matrix if there are at
+ * most MM_SOLVER_MATRIX_MAX codes. Shapes of more than 2^24 codes are
+ * refused.
+ *
+ * Return: the solver, or NULL with errno set
+ */
+struct mm_solver *mm_solver_new(unsigned pegs, unsigned colors,
+				unsigned threads);
+
+/* mm_solver_free() - free a solver and its score matrix */
+void mm_solver_free(struct mm_solver *solver);
+
+/* mm_solver_ncodes() - number of codes, colors^pegs */
+unsigned mm_solver_ncodes(const struct mm_solver *solver);
+
+/* mm_solver_code() - packed code of index @i, below mm_solver_ncodes() */
+__u64 mm_solver_code(const struct mm_solver *solver, unsigned i);
+
+/**
+ * mm_solver_index() - index of a packed code
+ * @solver: solver of the code's shape
+ * @code: packed code
+ *
+ * Return: the index, or -1 if @code is not a code of this shape
+ */
+long mm_solver_index(const struct mm_solver *solver, __u64 code);
+
+/**
+ * mm_solver_score() - score one code against another
+ * @solver: solver of the codes' shape
+ * @target: index of the secret code
+ * @guess: index of the guess
+ *
+ * Return: the score, packed with MM_SCORE()
+ */
+unsigned mm_solver_score(const struct mm_solver *solver, unsigned target,
+			 unsigned guess);
+
+/**
+ * mm_solver_game_init() - start tracking a game
+ * @game: game to initialize; every code is a candidate
+ * @solver: shape of the game
+ *
+ * Return: 0 on success, -1 with errno set on failure
+ */
+int mm_solver_game_init(struct mm_solver_game *game,
+			const struct mm_solver *solver);
+
+/* mm_solver_game_free() - free what mm_solver_game_init() allocated */
+void mm_solver_game_free(struct mm_solver_game *game);
+
+/**
+ * mm_solver_feed() - narrow the candidates down by a scored guess
+ * @game: game the guess was made in
+ * @guess: index of the guess
+ * @score: score the guess got, packed with MM_SCORE()
+ *
+ * Return: candidates left; 0 means the scores contradict each other
+ */
+unsigned mm_solver_feed(struct mm_solver_game *game, unsigned guess,
+			unsigned score);
+
+/**
+ * mm_solver_next() - pick the next guess of a game
+ * @game: game to guess in, with at least one candidate left
+ * @strategy: how to rank the guesses
+ *
+ * Every code is tried as a guess (or only the candidates, see
+ * MM_SOLVER_FULL_POOL_MAX, or a sample, see MM_SOLVER_SEARCH_MAX),
+ * spread over the solver's threads. Ties go
+ * to candidates, since those can win at once, then to the lowest index.
+ * The first guess of a game is computed once per solver and strategy,
+ * and cached in the solver, which is why @game's solver, const as it
+ * is, gets written here; the cache is guarded by a mutex of the solver.
+ *
+ * Return: index of the guess
+ */
+unsigned mm_solver_next(struct mm_solver_game *game,
+			enum mm_strategy strategy);
+
+/**
+ * mm_solver_solve() - play a whole game against a known secret
+ * @solver: shape of the game
+ * @secret: index of the secret code
+ * @strategy: how to rank the guesses
+ * @threads_per_guess: nonzero to spread each mm_solver_next() over the
+ * solver's threads; zero to search on the calling thread only, for
+ * callers that already solve many games in parallel
+ *
+ * Return: guesses it took to win, or -1 with errno set on failure
+ */
+int mm_solver_solve(const struct mm_solver *solver, unsigned secret,
+		    enum mm_strategy strategy, int threads_per_guess);
+
+#endif